@@ -0,0 +1,154 @@
+#include "buffer.hpp"
+#include "search.hpp"
+#include "finder.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+
+using Finder = const char* (*)(const char*, const char*, std::string_view);
+
+static std::string generate(const std::string& path, size_t bytes){
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && static_cast<size_t>(st.st_size) >= bytes) {
+        return path;
+    }
+    static const char* words[] = {"request", "latency", "buffer", "shard", "error", "warning",
+                                  "connection", "timeout", "user", "session", "GET", "POST", "200", "404"};
+    std::mt19937 rng(42);
+    std::ofstream out(path);
+    std::string line;
+    size_t written = 0;
+    while (written < bytes) {
+        line.clear();
+        size_t count = 4 + rng() % 12;
+        for (size_t i = 0; i < count; ++i) {
+            line += words[rng() % (sizeof(words) / sizeof(words[0]))];
+            line += (rng() % 5 == 0) ? '\t' : ' ';
+        }
+        line += '\n';
+        out << line;
+        written += line.length();
+    }
+    return path;
+}
+
+static void run_search(const TextBuffer& lines, const char* name, Finder finder, std::string_view needle){
+    size_t bytes = 0;
+    size_t matches = 0;
+    auto begin = std::chrono::steady_clock::now();
+    lines.each_span(0, [&](size_t, std::string_view text){
+        const char* end = text.data() + text.length();
+        for (const char* hit = finder(text.data(), end, needle); hit; hit = finder(hit + needle.length(), end, needle)) {
+            ++matches;
+        }
+        bytes += text.length();
+        return false;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-8s %8.1f MB %8zu hits %8.3f s %8.2f GB/s\n", name, bytes / 1e6, matches, seconds, bytes / seconds / 1e9);
+}
+
+// Walks every match from the bottom up, as pressing N from the end of the
+// file would, so the needle should be one that matches often.
+static void run_search_last(const TextBuffer& lines, const char* name, Finder finder, std::string_view needle){
+    size_t bytes = 0;
+    size_t matches = 0;
+    auto begin = std::chrono::steady_clock::now();
+    lines.each_span_reverse(lines.size() - 1, [&](size_t, std::string_view text){
+        const char* end = text.data() + text.length();
+        for (const char* hit = finder(text.data(), end, needle); hit; hit = finder(text.data(), hit + needle.length() - 1, needle)) {
+            ++matches;
+        }
+        bytes += text.length();
+        return false;
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-8s %8.1f MB %8zu hits %8.3f s %8.2f GB/s\n", name, bytes / 1e6, matches, seconds, bytes / seconds / 1e9);
+}
+
+static const char* memmem_finder(const char* begin, const char* end, std::string_view needle){
+    return static_cast<const char*>(memmem(begin, static_cast<size_t>(end - begin), needle.data(), needle.length()));
+}
+
+// A tree the size of a large monorepo: paths a few directories deep built
+// from a small vocabulary, so short queries match most of them.
+static std::shared_ptr<FileList> generate_paths(size_t count){
+    static const char* parts[] = {"src", "lib", "core", "net", "util", "test", "docs", "include", "server",
+                                  "client", "parser", "render", "storage", "index", "cache", "event"};
+    static const char* kinds[] = {".cpp", ".hpp", ".c", ".h", ".md", ".json", ".py", ".txt"};
+    std::mt19937 rng(7);
+    auto files = std::make_shared<FileList>();
+    for (size_t i = 0; i < count; ++i) {
+        files->starts.push_back(static_cast<uint32_t>(files->text.length()));
+        size_t depth = 2 + rng() % 5;
+        for (size_t d = 0; d < depth; ++d) {
+            files->text += parts[rng() % (sizeof(parts) / sizeof(parts[0]))];
+            files->text += d + 1 < depth ? "/" : "_";
+        }
+        files->text += std::to_string(rng() % 1000);
+        files->text += kinds[rng() % (sizeof(kinds) / sizeof(kinds[0]))];
+    }
+    files->starts.push_back(static_cast<uint32_t>(files->text.length()));
+    return files;
+}
+
+// Types the query one key at a time and then deletes it, timing what the
+// picker does per keystroke: narrow the matches and rank the best screenful.
+static void run_finder(size_t count, const std::string& query){
+    FileFinder finder;
+    finder.set_files(generate_paths(count));
+    printf("finder: %zu paths, query \"%s\"\n", finder.total(), query.c_str());
+    std::string typed;
+    auto key = [&](){
+        auto begin = std::chrono::steady_clock::now();
+        finder.set_query(typed);
+        const std::vector<FinderMatch>& best = finder.best(24);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        printf("  %-12s %8zu matches %8.2f ms  %s\n", ("\"" + typed + "\"").c_str(), finder.matched(), ms,
+               best.empty() ? "" : std::string(finder.path(best[0].file)).c_str());
+    };
+    for (char c : query) {
+        typed += c;
+        key();
+    }
+    while (!typed.empty()) {
+        typed.pop_back();
+        key();
+    }
+}
+
+int main(int argc, char** argv){
+    std::string path = argc > 1 ? argv[1] : generate("/tmp/shard-bench.txt", 256u << 20);
+    std::string needle = argc > 2 ? argv[2] : "sessionX";
+
+    auto file = std::make_shared<MappedFile>(path);
+    file->wait();
+    TextBuffer lines;
+    lines.assign(file);
+    printf("search: %s, %zu lines, needle \"%s\", dispatch %s\n", path.c_str(), lines.size(), needle.c_str(), find_text_backend());
+
+    run_search(lines, "memmem", memmem_finder, needle);
+    run_search(lines, "scalar", find_text_scalar, needle);
+#if defined(__x86_64__) || defined(__i386__)
+    run_search(lines, "sse2", find_text_sse2, needle);
+    if (__builtin_cpu_supports("avx2")) {
+        run_search(lines, "avx2", find_text_avx2, needle);
+    }
+#endif
+
+    std::string common = argc > 3 ? argv[3] : "session";
+    printf("search backwards: needle \"%s\"\n", common.c_str());
+    run_search_last(lines, "scalar", find_text_last_scalar, common);
+#if defined(__x86_64__) || defined(__i386__)
+    run_search_last(lines, "sse2", find_text_last_sse2, common);
+    if (__builtin_cpu_supports("avx2")) {
+        run_search_last(lines, "avx2", find_text_last_avx2, common);
+    }
+#endif
+    run_finder(500000, "srvidx");
+    return 0;
+}
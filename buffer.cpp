@@ -0,0 +1,609 @@
+#include "buffer.hpp"
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Piece {
+    std::shared_ptr<Chunk> chunk;
+    size_t first;
+    size_t count;
+    size_t total;
+    uint32_t prio;
+    std::unique_ptr<Piece> left;
+    std::unique_ptr<Piece> right;
+};
+
+using Tree = std::unique_ptr<Piece>;
+
+static const size_t COPY_BLOCK = 8 << 20;
+
+static uint32_t next_prio(){
+    static uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static size_t total(const Tree& t){
+    return t ? t->total : 0;
+}
+
+static void pull(Piece* p){
+    p->total = p->count + total(p->left) + total(p->right);
+}
+
+static Tree make_piece(std::shared_ptr<Chunk> chunk, size_t first, size_t count){
+    Tree p = std::make_unique<Piece>();
+    p->chunk = std::move(chunk);
+    p->first = first;
+    p->count = count;
+    p->total = count;
+    p->prio = next_prio();
+    return p;
+}
+
+static Tree merge(Tree a, Tree b){
+    if (!a) return b;
+    if (!b) return a;
+    if (a->prio > b->prio) {
+        a->right = merge(std::move(a->right), std::move(b));
+        pull(a.get());
+        return a;
+    }
+    b->left = merge(std::move(a), std::move(b->left));
+    pull(b.get());
+    return b;
+}
+
+// Splits t into the first k lines and the rest, cutting a piece in two when
+// the boundary falls inside it.
+static void split(Tree t, size_t k, Tree& a, Tree& b){
+    if (!t) {
+        a = nullptr;
+        b = nullptr;
+        return;
+    }
+    size_t left_size = total(t->left);
+    if (k <= left_size) {
+        split(std::move(t->left), k, a, t->left);
+        pull(t.get());
+        b = std::move(t);
+    } else if (k >= left_size + t->count) {
+        split(std::move(t->right), k - left_size - t->count, t->right, b);
+        pull(t.get());
+        a = std::move(t);
+    } else {
+        size_t offset = k - left_size;
+        Tree rest = make_piece(t->chunk, t->first + offset, t->count - offset);
+        Tree right = std::move(t->right);
+        t->count = offset;
+        pull(t.get());
+        a = std::move(t);
+        b = merge(std::move(rest), std::move(right));
+    }
+}
+
+// Lines of one chunk are stored back to back, so a run of them is a single
+// contiguous block of text with '\n' between the lines.
+static std::string_view span_of(const Chunk& chunk, size_t first, size_t count){
+    std::string_view head = chunk.line(first);
+    std::string_view last = chunk.line(first + count - 1);
+    return std::string_view(head.data(), static_cast<size_t>(last.data() + last.length() - head.data()));
+}
+
+std::string_view slice_text(const Slice& slice){
+    return slice.count ? span_of(*slice.chunk, slice.first, slice.count) : std::string_view();
+}
+
+static bool visit_forward(const Piece* p, size_t base, size_t from, const SpanVisitor& visit){
+    if (!p) return false;
+    size_t start = base + total(p->left);
+    if (from < start && visit_forward(p->left.get(), base, from, visit)) return true;
+    if (from < start + p->count) {
+        size_t skip = from > start ? from - start : 0;
+        if (visit(start + skip, span_of(*p->chunk, p->first + skip, p->count - skip))) return true;
+    }
+    return visit_forward(p->right.get(), start + p->count, from, visit);
+}
+
+static bool visit_backward(const Piece* p, size_t base, size_t to, const SpanVisitor& visit){
+    if (!p) return false;
+    size_t start = base + total(p->left);
+    if (to >= start + p->count && visit_backward(p->right.get(), start + p->count, to, visit)) return true;
+    if (to >= start) {
+        size_t count = std::min(p->count, to - start + 1);
+        if (visit(start, span_of(*p->chunk, p->first, count))) return true;
+    }
+    return visit_backward(p->left.get(), base, to, visit);
+}
+
+TextChunk::TextChunk(std::string content) : text(std::move(content)){
+    starts.push_back(0);
+    for (size_t pos = text.find('\n'); pos != std::string::npos; pos = text.find('\n', pos + 1)) {
+        starts.push_back(pos + 1);
+    }
+}
+
+size_t TextChunk::count() const {
+    return starts.size();
+}
+
+std::string_view TextChunk::line(size_t i) const {
+    size_t end = (i + 1 < starts.size()) ? starts[i + 1] - 1 : text.size();
+    return std::string_view(text).substr(starts[i], end - starts[i]);
+}
+
+std::string* TextChunk::mutable_line(){
+    return starts.size() == 1 ? &text : nullptr;
+}
+
+size_t TextChunk::footprint() const {
+    return sizeof(TextChunk) + text.capacity() + starts.capacity() * sizeof(size_t);
+}
+
+MappedFile::MappedFile(const std::string& path)
+    : data(nullptr), length(0), device(0), inode(0), detached(false), scanned(0), scanned_bytes(0), published(0), done(false), stop(false){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file. Permission denied! File: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    device = st.st_dev;
+    inode = st.st_ino;
+    if (st.st_size > 0) {
+        void* map = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Could not map file: " + path);
+        }
+        data = static_cast<const char*>(map);
+        length = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd);
+    blocks.resize(length / block_lines + 2);
+    push(0);
+}
+
+MappedFile::~MappedFile(){
+    stop = true;
+    if (loader.joinable()) {
+        loader.join();
+    }
+    if (data) {
+        munmap(const_cast<char*>(data), length);
+    }
+}
+
+size_t MappedFile::footprint() const {
+    size_t used = (published.load(std::memory_order_acquire) + block_lines - 1) / block_lines;
+    return sizeof(MappedFile) + blocks.capacity() * sizeof(blocks[0]) + used * block_lines * sizeof(size_t) +
+           (detached ? length : 0);
+}
+
+size_t MappedFile::mapped() const {
+    return detached ? 0 : length;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+// Swaps the file's pages for private copies moved to the same addresses, so
+// the text, and every view of it, stays as it is when the file is rewritten
+// or truncated in place; reading a truncated mapping would raise SIGBUS.
+// The copies are memory of our own from then on. The copy goes a block at a
+// time, adding to copied as it does, so a save thread can report progress
+// while readers go on using the mapping, which holds the same bytes before
+// and after the swap.
+bool MappedFile::detach(std::atomic<size_t>* copied){
+    if (detached || length == 0) {
+        return true;
+    }
+    void* copy = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED) {
+        return false;
+    }
+    for (size_t at = 0; at < length; at += COPY_BLOCK) {
+        size_t take = std::min(COPY_BLOCK, length - at);
+        memcpy(static_cast<char*>(copy) + at, data + at, take);
+        if (copied) {
+            copied->fetch_add(take, std::memory_order_relaxed);
+        }
+    }
+    mprotect(copy, length, PROT_READ);
+    if (mremap(copy, length, length, MREMAP_MAYMOVE | MREMAP_FIXED, const_cast<char*>(data)) == MAP_FAILED) {
+        munmap(copy, length);
+        return false;
+    }
+    detached = true;
+    return true;
+}
+
+bool MappedFile::same_file(const struct stat& st) const {
+    return st.st_dev == device && st.st_ino == inode;
+}
+
+// Called when the file at path was seen to shrink or be replaced. A file
+// that was replaced keeps its old pages and needs nothing; one cut short in
+// place loses the pages past its new end, and reading those would raise
+// SIGBUS, so they are swapped for zeros. What is left of the old text there
+// is gone with the file; only the pages still inside it read the file's
+// bytes, whatever they now are.
+void MappedFile::truncated(const std::string& path){
+    struct stat st;
+    if (detached || length == 0 || stat(path.c_str(), &st) != 0 || !same_file(st)) {
+        return;
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t keep = (static_cast<size_t>(st.st_size) + page - 1) / page * page;
+    if (keep < length) {
+        mmap(const_cast<char*>(data) + keep, length - keep, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+}
+
+// Line starts live in fixed blocks behind a table sized up front, so the
+// loader can publish new entries while the UI thread reads the older ones.
+size_t MappedFile::start(size_t i) const {
+    return blocks[i / block_lines][i % block_lines];
+}
+
+void MappedFile::push(size_t offset){
+    size_t n = published.load(std::memory_order_relaxed);
+    std::unique_ptr<size_t[]>& block = blocks[n / block_lines];
+    if (!block) {
+        block.reset(new size_t[block_lines]);
+    }
+    block[n % block_lines] = offset;
+    published.store(n + 1, std::memory_order_release);
+}
+
+size_t MappedFile::count() const {
+    bool finished = done.load(std::memory_order_acquire);
+    size_t n = published.load(std::memory_order_acquire);
+    return finished ? n : n - 1;
+}
+
+std::string_view MappedFile::line(size_t i) const {
+    size_t end;
+    if (i + 1 < published.load(std::memory_order_acquire)) {
+        end = start(i + 1) - 1;
+    } else {
+        end = (length > 0 && data[length - 1] == '\n') ? length - 1 : length;
+    }
+    return std::string_view(data + start(i), end - start(i));
+}
+
+// Scans forward for newlines until at least n lines are known; unread parts of
+// the mapping are never touched, so opening costs the same for any file size.
+void MappedFile::scan(size_t n){
+    size_t lines = 0;
+    while (!done.load(std::memory_order_relaxed) && published.load(std::memory_order_relaxed) <= n) {
+        if (stop.load(std::memory_order_relaxed)) return;
+        const void* hit = scanned < length ? memchr(data + scanned, '\n', length - scanned) : nullptr;
+        if (!hit) {
+            scanned = length;
+            done.store(true, std::memory_order_release);
+            break;
+        }
+        scanned = static_cast<size_t>(static_cast<const char*>(hit) - data) + 1;
+        if (scanned < length) {
+            push(scanned);
+        } else {
+            done.store(true, std::memory_order_release);
+        }
+        if (++lines % 4096 == 0) {
+            scanned_bytes.store(scanned, std::memory_order_relaxed);
+        }
+    }
+    scanned_bytes.store(scanned, std::memory_order_relaxed);
+}
+
+bool MappedFile::index(size_t n){
+    if (!loader.joinable()) {
+        scan(n);
+    }
+    return count() >= n;
+}
+
+void MappedFile::load(){
+    if (!loader.joinable() && !complete()) {
+        loader = std::thread([this]{ scan(SIZE_MAX); });
+    }
+}
+
+void MappedFile::wait(){
+    if (loader.joinable()) {
+        loader.join();
+    }
+    scan(SIZE_MAX);
+}
+
+bool MappedFile::complete() const {
+    return done.load(std::memory_order_acquire);
+}
+
+double MappedFile::progress() const {
+    return length ? static_cast<double>(scanned_bytes.load(std::memory_order_relaxed)) / length : 1.0;
+}
+
+// Everything from line i to the end of the file, whether or not the loader
+// has indexed it yet.
+std::string_view MappedFile::rest(size_t i) const {
+    if (i >= published.load(std::memory_order_acquire)) {
+        return std::string_view();
+    }
+    size_t end = (length > 0 && data[length - 1] == '\n') ? length - 1 : length;
+    return std::string_view(data + start(i), end - start(i));
+}
+
+TextBuffer::TextBuffer() : tail_first(0){}
+
+TextBuffer::~TextBuffer(){}
+
+size_t TextBuffer::size() const {
+    return total(root) + (tail ? tail->count() - tail_first : 0);
+}
+
+bool TextBuffer::empty() const {
+    return size() == 0;
+}
+
+void TextBuffer::wait(){
+    if (tail) {
+        tail->wait();
+    }
+}
+
+bool TextBuffer::loading() const {
+    return tail && !tail->complete();
+}
+
+double TextBuffer::progress() const {
+    return tail ? tail->progress() : 1.0;
+}
+
+bool TextBuffer::reach(size_t n){
+    if (tail && n > total(root)) {
+        size_t want = n - total(root);
+        tail->index(want > SIZE_MAX - tail_first ? SIZE_MAX : tail_first + want);
+    }
+    return size() >= n;
+}
+
+bool TextBuffer::each_span(size_t from, const SpanVisitor& visit) const {
+    size_t settled = total(root);
+    if (from < settled && visit_forward(root.get(), 0, from, visit)) return true;
+    if (tail) {
+        size_t known = tail->count() - tail_first;
+        if (from < settled + known) {
+            size_t skip = from > settled ? from - settled : 0;
+            return visit(settled + skip, span_of(*tail, tail_first + skip, known - skip));
+        }
+    }
+    return false;
+}
+
+bool TextBuffer::each_span_reverse(size_t to, const SpanVisitor& visit) const {
+    size_t settled = total(root);
+    if (tail && to >= settled) {
+        size_t known = tail->count() - tail_first;
+        if (known > 0) {
+            size_t count = std::min(known, to - settled + 1);
+            if (visit(settled, span_of(*tail, tail_first, count))) return true;
+        }
+    }
+    return settled > 0 && visit_backward(root.get(), 0, std::min(to, settled - 1), visit);
+}
+
+static void collect_range(const Piece* p, size_t base, size_t from, size_t to, std::vector<Slice>& out){
+    if (!p || from >= to) return;
+    size_t start = base + total(p->left);
+    if (from < start) collect_range(p->left.get(), base, from, std::min(to, start), out);
+    size_t first = std::max(from, start);
+    size_t last = std::min(to, start + p->count);
+    if (first < last) {
+        out.push_back({p->chunk, p->first + (first - start), last - first});
+    }
+    if (to > start + p->count) collect_range(p->right.get(), start + p->count, std::max(from, start + p->count), to, out);
+}
+
+static void collect(const Piece* p, Snapshot& shot){
+    if (!p) return;
+    collect(p->left.get(), shot);
+    if (shot.chunks.empty() || shot.chunks.back() != p->chunk) {
+        shot.chunks.push_back(p->chunk);
+    }
+    shot.spans.push_back(span_of(*p->chunk, p->first, p->count));
+    collect(p->right.get(), shot);
+}
+
+// Captures the current text as spans of shared chunks, so it can be read on
+// another thread while this buffer keeps changing: a chunk held by a snapshot
+// is never modified in place, and the unindexed tail is taken as one span.
+Snapshot TextBuffer::snapshot() const {
+    Snapshot shot;
+    collect(root.get(), shot);
+    if (tail && (tail_first < tail->count() || !tail->complete())) {
+        shot.chunks.push_back(tail);
+        shot.spans.push_back(tail->rest(tail_first));
+    }
+    for (std::string_view span : shot.spans) {
+        shot.bytes += span.length();
+    }
+    if (!shot.spans.empty()) {
+        shot.bytes += shot.spans.size() - 1;
+    }
+    return shot;
+}
+
+static void measure(const Piece* p, std::unordered_set<const Chunk*>& seen, size_t& heap, size_t& mapped){
+    if (!p) return;
+    heap += sizeof(Piece);
+    if (seen.insert(p->chunk.get()).second) {
+        heap += p->chunk->footprint();
+        if (auto file = dynamic_cast<const MappedFile*>(p->chunk.get())) {
+            mapped += file->mapped();
+        }
+    }
+    measure(p->left.get(), seen, heap, mapped);
+    measure(p->right.get(), seen, heap, mapped);
+}
+
+// Heap bytes held by the tree and its chunks, and bytes of mapped files, with
+// each chunk counted once however many pieces share it.
+void TextBuffer::usage(size_t& heap, size_t& mapped) const {
+    std::unordered_set<const Chunk*> seen;
+    heap = 0;
+    mapped = 0;
+    measure(root.get(), seen, heap, mapped);
+    if (tail && seen.insert(tail.get()).second) {
+        heap += tail->footprint();
+        mapped += tail->mapped();
+    }
+}
+
+// Moves lines off the front of the lazily indexed tail into the tree so that
+// the first n lines can be restructured.
+void TextBuffer::settle(size_t n){
+    size_t settled = total(root);
+    if (!tail || n <= settled) return;
+    size_t take = std::min(n - settled, tail->count() - tail_first);
+    if (take > 0) {
+        root = merge(std::move(root), make_piece(tail, tail_first, take));
+        tail_first += take;
+    }
+    if (tail->complete() && tail_first == tail->count()) {
+        tail.reset();
+    }
+}
+
+const Piece* TextBuffer::find(size_t& i) const {
+    const Piece* p = root.get();
+    while (p) {
+        size_t left_size = total(p->left);
+        if (i < left_size) {
+            p = p->left.get();
+        } else if (i < left_size + p->count) {
+            i -= left_size;
+            return p;
+        } else {
+            i -= left_size + p->count;
+            p = p->right.get();
+        }
+    }
+    return nullptr;
+}
+
+std::string_view TextBuffer::operator[](size_t i) const {
+    size_t settled = total(root);
+    if (i >= settled) {
+        return tail ? tail->line(tail_first + i - settled) : std::string_view();
+    }
+    const Piece* p = find(i);
+    return p ? p->chunk->line(p->first + i) : std::string_view();
+}
+
+std::string& TextBuffer::edit(size_t i){
+    settle(i + 1);
+    size_t offset = i;
+    const Piece* p = find(offset);
+    if (p && p->count == 1 && p->chunk.use_count() == 1) {
+        if (std::string* line = p->chunk->mutable_line()) {
+            return *line;
+        }
+    }
+
+    Tree a, b, c;
+    split(std::move(root), i, a, b);
+    split(std::move(b), 1, b, c);
+    auto chunk = std::make_shared<TextChunk>(std::string(b->chunk->line(b->first)));
+    std::string& line = *chunk->mutable_line();
+    b = make_piece(std::move(chunk), 0, 1);
+    root = merge(merge(std::move(a), std::move(b)), std::move(c));
+    return line;
+}
+
+void TextBuffer::assign(std::string content){
+    auto chunk = std::make_shared<TextChunk>(std::move(content));
+    size_t count = chunk->count();
+    root = make_piece(std::move(chunk), 0, count);
+    tail.reset();
+    tail_first = 0;
+}
+
+void TextBuffer::assign(std::shared_ptr<MappedFile> file){
+    root.reset();
+    tail = std::move(file);
+    tail_first = 0;
+}
+
+// Shares lines [i, i + n) as slices of the chunks that hold them; the chunks
+// are pinned by the slices, so they are never modified in place afterwards.
+std::vector<Slice> TextBuffer::slices(size_t i, size_t n) const {
+    std::vector<Slice> out;
+    size_t settled = total(root);
+    collect_range(root.get(), 0, i, std::min(i + n, settled), out);
+    if (tail && i + n > settled) {
+        size_t skip = i > settled ? i - settled : 0;
+        size_t end = std::min(i + n - settled, tail->count() - tail_first);
+        if (end > skip) {
+            out.push_back({tail, tail_first + skip, end - skip});
+        }
+    }
+    return out;
+}
+
+// Puts shared slices in as pieces before line i; the text is not copied.
+void TextBuffer::insert(size_t i, const std::vector<Slice>& slices){
+    settle(i);
+    Tree a, b;
+    split(std::move(root), i, a, b);
+    for (const Slice& slice : slices) {
+        if (slice.count > 0) {
+            a = merge(std::move(a), make_piece(slice.chunk, slice.first, slice.count));
+        }
+    }
+    root = merge(std::move(a), std::move(b));
+}
+
+void TextBuffer::insert(size_t i, std::string text){
+    settle(i);
+    Tree a, b;
+    split(std::move(root), i, a, b);
+    auto chunk = std::make_shared<TextChunk>(std::move(text));
+    size_t count = chunk->count();
+    Tree p = make_piece(std::move(chunk), 0, count);
+    root = merge(merge(std::move(a), std::move(p)), std::move(b));
+}
+
+void TextBuffer::erase(size_t i, size_t n){
+    settle(i + n);
+    Tree a, b, c;
+    split(std::move(root), i, a, b);
+    split(std::move(b), n, b, c);
+    root = merge(std::move(a), std::move(c));
+}
+
+void TextBuffer::push_back(std::string line){
+    if (tail) {
+        tail->wait();
+        settle(SIZE_MAX);
+    }
+    insert(size(), std::move(line));
+}
+
+void TextBuffer::clear(){
+    root.reset();
+    tail.reset();
+    tail_first = 0;
+}
@@ -0,0 +1,137 @@
+#ifndef BUFFER_HPP
+#define BUFFER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+class Chunk {
+public:
+    virtual ~Chunk() = default;
+    virtual size_t count() const = 0;
+    virtual std::string_view line(size_t i) const = 0;
+    virtual std::string* mutable_line() { return nullptr; }
+    virtual size_t footprint() const = 0;
+};
+
+class TextChunk : public Chunk {
+public:
+    explicit TextChunk(std::string content);
+    size_t count() const override;
+    std::string_view line(size_t i) const override;
+    std::string* mutable_line() override;
+    size_t footprint() const override;
+
+private:
+    std::string text;
+    std::vector<size_t> starts;
+};
+
+class MappedFile : public Chunk {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    size_t count() const override;
+    std::string_view line(size_t i) const override;
+    size_t footprint() const override;
+    size_t mapped() const;
+    size_t size() const;
+    bool detach(std::atomic<size_t>* copied = nullptr);
+    bool same_file(const struct stat& st) const;
+    void truncated(const std::string& path);
+    bool index(size_t lines);
+    void load();
+    void wait();
+    bool complete() const;
+    double progress() const;
+    std::string_view rest(size_t i) const;
+
+private:
+    static constexpr size_t block_lines = 1 << 16;
+
+    const char* data;
+    size_t length;
+    dev_t device;
+    ino_t inode;
+    std::atomic<bool> detached;
+    size_t scanned;
+    std::atomic<size_t> scanned_bytes;
+    std::atomic<size_t> published;
+    std::atomic<bool> done;
+    std::atomic<bool> stop;
+    std::vector<std::unique_ptr<size_t[]>> blocks;
+    std::thread loader;
+
+    size_t start(size_t i) const;
+    void push(size_t offset);
+    void scan(size_t n);
+};
+
+struct Piece;
+
+// A run of whole lines of a chunk, held without copying the text.
+struct Slice {
+    std::shared_ptr<Chunk> chunk;
+    size_t first = 0;
+    size_t count = 0;
+};
+
+std::string_view slice_text(const Slice& slice);
+
+struct Snapshot {
+    std::vector<std::shared_ptr<Chunk>> chunks;
+    std::vector<std::string_view> spans;
+    size_t bytes = 0;
+};
+
+using SpanVisitor = std::function<bool(size_t first_line, std::string_view text)>;
+
+class TextBuffer {
+public:
+    TextBuffer();
+    ~TextBuffer();
+    TextBuffer(const TextBuffer&) = delete;
+    TextBuffer& operator=(const TextBuffer&) = delete;
+
+    size_t size() const;
+    bool empty() const;
+    std::string_view operator[](size_t i) const;
+    std::string& edit(size_t i);
+    bool reach(size_t n);
+    bool each_span(size_t from, const SpanVisitor& visit) const;
+    bool each_span_reverse(size_t to, const SpanVisitor& visit) const;
+    Snapshot snapshot() const;
+    void usage(size_t& heap, size_t& mapped) const;
+    void wait();
+    bool loading() const;
+    double progress() const;
+
+    void assign(std::string content);
+    void assign(std::shared_ptr<MappedFile> file);
+    std::vector<Slice> slices(size_t i, size_t n) const;
+    void insert(size_t i, std::string text);
+    void insert(size_t i, const std::vector<Slice>& slices);
+    void erase(size_t i, size_t n = 1);
+    void push_back(std::string line);
+    void clear();
+
+private:
+    std::unique_ptr<Piece> root;
+    std::shared_ptr<MappedFile> tail;
+    size_t tail_first;
+
+    const Piece* find(size_t& i) const;
+    void settle(size_t n);
+};
+
+#endif
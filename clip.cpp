@@ -0,0 +1,146 @@
+#include "clip.hpp"
+#include <memory>
+
+static Slice own_line(std::string line){
+    Slice slice;
+    slice.chunk = std::make_shared<TextChunk>(std::move(line));
+    slice.count = 1;
+    return slice;
+}
+
+Clip::Clip() : broken(false), middle_lines(0), middle_bytes(0){}
+
+Clip::Clip(std::string text) : broken(false), middle_lines(0), middle_bytes(0){
+    size_t first_break = text.find('\n');
+    if (first_break == std::string::npos) {
+        first = std::move(text);
+        return;
+    }
+    size_t last_break = text.rfind('\n');
+    broken = true;
+    last = text.substr(last_break + 1);
+    if (last_break > first_break) {
+        auto chunk = std::make_shared<TextChunk>(text.substr(first_break + 1, last_break - first_break - 1));
+        size_t count = chunk->count();
+        middle.push_back({std::move(chunk), 0, count});
+    }
+    text.resize(first_break);
+    first = std::move(text);
+    measure();
+}
+
+Clip::Clip(std::string head, std::vector<Slice> lines, std::string tail)
+    : first(std::move(head)), middle(std::move(lines)), last(std::move(tail)), broken(true){
+    measure();
+}
+
+void Clip::measure(){
+    middle_lines = 0;
+    middle_bytes = 0;
+    for (const Slice& slice : middle) {
+        middle_lines += slice.count;
+        middle_bytes += slice_text(slice).length() + 1;
+    }
+}
+
+bool Clip::empty() const {
+    return length() == 0;
+}
+
+size_t Clip::length() const {
+    return first.length() + middle_bytes + (broken ? 1 + last.length() : 0);
+}
+
+size_t Clip::breaks() const {
+    return broken ? middle_lines + 1 : 0;
+}
+
+bool Clip::ends_with_break() const {
+    return broken && last.empty();
+}
+
+// Where the text ends when it is put in at (row, col).
+void Clip::end(size_t row, size_t col, size_t& end_row, size_t& end_col) const {
+    if (!broken) {
+        end_row = row;
+        end_col = col + first.length();
+    } else {
+        end_row = row + breaks();
+        end_col = last.length();
+    }
+}
+
+std::string Clip::text() const {
+    std::string out;
+    out.reserve(length());
+    out += first;
+    for (const Slice& slice : middle) {
+        out += '\n';
+        out.append(slice_text(slice));
+    }
+    if (broken) {
+        out += '\n';
+        out += last;
+    }
+    return out;
+}
+
+// Bytes owned by the clip itself; shared chunks are counted by their buffer.
+size_t Clip::footprint() const {
+    return sizeof(Clip) + first.capacity() + last.capacity() + middle.capacity() * sizeof(Slice);
+}
+
+const std::string& Clip::head() const {
+    return first;
+}
+
+const std::vector<Slice>& Clip::lines() const {
+    return middle;
+}
+
+const std::string& Clip::tail() const {
+    return last;
+}
+
+Clip Clip::with_break_before() const {
+    Clip clip = *this;
+    if (clip.broken) {
+        clip.middle.insert(clip.middle.begin(), own_line(std::move(clip.first)));
+    } else {
+        clip.last = std::move(clip.first);
+        clip.broken = true;
+    }
+    clip.first.clear();
+    clip.measure();
+    return clip;
+}
+
+Clip Clip::with_break_after() const {
+    Clip clip = *this;
+    if (clip.broken) {
+        clip.middle.push_back(own_line(std::move(clip.last)));
+    } else {
+        clip.broken = true;
+    }
+    clip.last.clear();
+    clip.measure();
+    return clip;
+}
+
+Clip Clip::without_final_break() const {
+    Clip clip = *this;
+    if (!clip.ends_with_break()) {
+        return clip;
+    }
+    if (clip.middle.empty()) {
+        clip.broken = false;
+        return clip;
+    }
+    Slice& slice = clip.middle.back();
+    clip.last = std::string(slice.chunk->line(slice.first + slice.count - 1));
+    if (--slice.count == 0) {
+        clip.middle.pop_back();
+    }
+    clip.measure();
+    return clip;
+}
@@ -0,0 +1,46 @@
+#ifndef CLIP_HPP
+#define CLIP_HPP
+
+#include <string>
+#include <vector>
+#include "buffer.hpp"
+
+// Text held by a register or the undo journal. The whole lines in the middle
+// are shared slices of buffer chunks, so taking a region costs one entry per
+// piece it spans rather than its size; only the partial first and last lines
+// are copied. The text is head, then "\n" and each middle line, then "\n" and
+// tail when there is at least one line break.
+class Clip {
+public:
+    Clip();
+    explicit Clip(std::string text);
+    Clip(std::string head, std::vector<Slice> lines, std::string tail);
+
+    bool empty() const;
+    size_t length() const;
+    size_t breaks() const;
+    bool ends_with_break() const;
+    void end(size_t row, size_t col, size_t& end_row, size_t& end_col) const;
+    std::string text() const;
+    size_t footprint() const;
+
+    const std::string& head() const;
+    const std::vector<Slice>& lines() const;
+    const std::string& tail() const;
+
+    Clip with_break_before() const;
+    Clip with_break_after() const;
+    Clip without_final_break() const;
+
+private:
+    std::string first;
+    std::vector<Slice> middle;
+    std::string last;
+    bool broken;
+    size_t middle_lines;
+    size_t middle_bytes;
+
+    void measure();
+};
+
+#endif
@@ -0,0 +1,386 @@
+#include "fileindex.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char MAGIC[8] = {'S', 'H', 'A', 'R', 'D', 'X', '1', '\n'};
+static const int64_t SETTLE_SECONDS = 2;
+
+static void put_number(std::string& out, uint64_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_text(std::string& out, const std::string& text){
+    uint32_t length = static_cast<uint32_t>(text.length());
+    out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    out += text;
+}
+
+// Reads the cache front to back; any field that runs past the end fails
+// the whole read.
+class Reader {
+public:
+    Reader(const char* begin, const char* end) : at(begin), end(end){}
+
+    bool number(uint64_t& value){
+        if (static_cast<size_t>(end - at) < sizeof(value)) return false;
+        memcpy(&value, at, sizeof(value));
+        at += sizeof(value);
+        return true;
+    }
+
+    bool text(std::string& value){
+        uint32_t length;
+        if (static_cast<size_t>(end - at) < sizeof(length)) return false;
+        memcpy(&length, at, sizeof(length));
+        at += sizeof(length);
+        if (static_cast<size_t>(end - at) < length) return false;
+        value.assign(at, length);
+        at += length;
+        return true;
+    }
+
+    bool texts(std::vector<std::string>& values){
+        uint64_t count;
+        if (!number(count) || count > static_cast<size_t>(end - at)) return false;
+        values.resize(count);
+        for (std::string& value : values) {
+            if (!text(value)) return false;
+        }
+        return true;
+    }
+
+private:
+    const char* at;
+    const char* end;
+};
+
+// The cache lives under $XDG_CACHE_HOME/shard (~/.cache/shard), one file per
+// indexed directory, named by a hash of its real path.
+FileIndex::FileIndex(std::string root)
+    : root(std::move(root)), loaded(false), stop(false), running(false), listed_count(0), reused_count(0), busy(0){
+    if (char* resolved = realpath(this->root.c_str(), nullptr)) {
+        this->root = resolved;
+        free(resolved);
+    }
+    std::string base;
+    if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        base = xdg;
+    } else if (const char* home = getenv("HOME"); home && *home) {
+        base = std::string(home) + "/.cache";
+    }
+    if (!base.empty()) {
+        char name[32];
+        snprintf(name, sizeof(name), "%016zx.index", std::hash<std::string>()(this->root));
+        cache = base + "/shard/" + name;
+    }
+}
+
+FileIndex::~FileIndex(){
+    cancel();
+}
+
+void FileIndex::refresh(unsigned threads){
+    if (running.load(std::memory_order_acquire)) {
+        return;
+    }
+    if (runner.joinable()) {
+        runner.join();
+    }
+    stop = false;
+    running = true;
+    listed_count = 0;
+    reused_count = 0;
+    started = std::chrono::steady_clock::now();
+    runner = std::thread([this, threads]{ run(std::max(threads, 1u)); });
+}
+
+void FileIndex::cancel(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    ready.notify_all();
+    if (runner.joinable()) {
+        runner.join();
+    }
+}
+
+bool FileIndex::refreshing() const {
+    return running.load(std::memory_order_acquire);
+}
+
+// Hands over the newest list when there is one the caller has not seen.
+bool FileIndex::take(std::shared_ptr<const FileList>& files){
+    std::lock_guard<std::mutex> guard(lock);
+    if (!published) {
+        return false;
+    }
+    files = std::move(published);
+    published.reset();
+    return true;
+}
+
+size_t FileIndex::listed() const {
+    return listed_count.load(std::memory_order_relaxed);
+}
+
+size_t FileIndex::reused() const {
+    return reused_count.load(std::memory_order_relaxed);
+}
+
+double FileIndex::seconds() const {
+    auto end = refreshing() ? std::chrono::steady_clock::now() : ended;
+    return std::chrono::duration<double>(end - started).count();
+}
+
+// The directories known from the last walk are only read while the workers
+// run, and replaced by what they found once they are all done.
+void FileIndex::run(unsigned threads){
+    if (!loaded) {
+        loaded = true;
+        if (load()) {
+            publish();
+        }
+    }
+    tasks.assign(1, "");
+    busy = 0;
+    walked.clear();
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i) {
+        workers.emplace_back([this]{ work(); });
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    // nothing was listed and nothing went away: the list out there is current
+    bool changed = listed_count > 0 || walked.size() != known.size();
+    if (!stop && changed) {
+        Directories found;
+        found.reserve(walked.size());
+        for (auto& entry : walked) {
+            found.emplace(std::move(entry.first), std::move(entry.second));
+        }
+        known.swap(found);
+        publish();
+        save();
+    }
+    walked.clear();
+    walked.shrink_to_fit();
+    ended = std::chrono::steady_clock::now();
+    running.store(false, std::memory_order_release);
+}
+
+// Same scheme as the grep workers: a shared stack of directories, and the
+// walk is over when it is empty and no worker is inside a directory.
+void FileIndex::work(){
+    std::vector<std::string> found;
+    for (;;) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]{ return stop || !tasks.empty() || busy == 0; });
+            if (stop || tasks.empty()) {
+                break;
+            }
+            path = std::move(tasks.back());
+            tasks.pop_back();
+            ++busy;
+        }
+
+        Directory directory;
+        bool ok = visit(path, directory, found);
+
+        bool idle;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            --busy;
+            std::move(found.begin(), found.end(), std::back_inserter(tasks));
+            if (ok) {
+                walked.emplace_back(std::move(path), std::move(directory));
+            }
+            idle = busy == 0 && tasks.empty();
+        }
+        if (idle || found.size() > 1) {
+            ready.notify_all();
+        } else if (!found.empty()) {
+            ready.notify_one();
+        }
+        found.clear();
+    }
+}
+
+// Lists a directory unless its mtime says the names kept for it are still
+// right. One that changed in the last couple of seconds could change again
+// within the same mtime, so it is stored as unknown and listed next time.
+bool FileIndex::visit(const std::string& path, Directory& directory, std::vector<std::string>& found){
+    std::string full = path.empty() ? root : root + "/" + path;
+    struct stat st;
+    if (stat(full.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    directory.seconds = st.st_mtim.tv_sec;
+    directory.nanoseconds = st.st_mtim.tv_nsec;
+
+    auto old = known.find(path);
+    if (old != known.end() && old->second.seconds == directory.seconds &&
+        old->second.nanoseconds == directory.nanoseconds) {
+        directory.files = old->second.files;
+        directory.directories = old->second.directories;
+        reused_count.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        std::error_code error;
+        for (fs::directory_iterator it(full, fs::directory_options::skip_permission_denied, error), end;
+             !error && it != end; it.increment(error)) {
+            if (it->is_symlink(error) || error) {
+                error.clear();
+                continue;
+            }
+            std::string name = it->path().filename().string();
+            if (it->is_directory(error)) {
+                if (name != ".git" && name != ".hg" && name != ".svn") {
+                    directory.directories.push_back(std::move(name));
+                }
+            } else if (it->is_regular_file(error)) {
+                directory.files.push_back(std::move(name));
+            }
+        }
+        if (directory.seconds + SETTLE_SECONDS >= static_cast<int64_t>(time(nullptr))) {
+            directory.seconds = -1;
+        }
+        listed_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    for (const std::string& name : directory.directories) {
+        found.push_back(path.empty() ? name : path + "/" + name);
+    }
+    return true;
+}
+
+// Packs the known files into one sorted list for the finder.
+void FileIndex::publish(){
+    std::vector<std::string> paths;
+    for (const auto& [path, directory] : known) {
+        for (const std::string& name : directory.files) {
+            paths.push_back(path.empty() ? name : path + "/" + name);
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    auto files = std::make_shared<FileList>();
+    size_t bytes = 0;
+    for (const std::string& path : paths) {
+        bytes += path.length();
+    }
+    files->text.reserve(bytes);
+    files->starts.reserve(paths.size() + 1);
+    for (const std::string& path : paths) {
+        files->starts.push_back(static_cast<uint32_t>(files->text.length()));
+        files->text += path;
+    }
+    files->starts.push_back(static_cast<uint32_t>(files->text.length()));
+
+    std::lock_guard<std::mutex> guard(lock);
+    published = std::move(files);
+}
+
+bool FileIndex::load(){
+    if (cache.empty()) {
+        return false;
+    }
+    int in = ::open(cache.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    std::string data;
+    struct stat st;
+    if (fstat(in, &st) == 0) {
+        data.resize(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::read(in, &data[done], data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        data.resize(done);
+    }
+    ::close(in);
+    if (data.size() < sizeof(MAGIC) || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+
+    Reader reader(data.data() + sizeof(MAGIC), data.data() + data.size());
+    std::string indexed;
+    uint64_t count;
+    if (!reader.text(indexed) || indexed != root || !reader.number(count)) {
+        return false;
+    }
+    Directories found;
+    for (uint64_t i = 0; i < count; ++i) {
+        std::string path;
+        Directory directory;
+        uint64_t seconds, nanoseconds;
+        if (!reader.text(path) || !reader.number(seconds) || !reader.number(nanoseconds) ||
+            !reader.texts(directory.files) || !reader.texts(directory.directories)) {
+            return false;
+        }
+        directory.seconds = static_cast<int64_t>(seconds);
+        directory.nanoseconds = static_cast<int64_t>(nanoseconds);
+        found.emplace(std::move(path), std::move(directory));
+    }
+    known.swap(found);
+    return true;
+}
+
+// Written beside the old cache and renamed over it, so two editors indexing
+// the same tree never leave a torn file.
+bool FileIndex::save() const {
+    if (cache.empty()) {
+        return false;
+    }
+    std::error_code error;
+    fs::create_directories(fs::path(cache).parent_path(), error);
+    std::string data(MAGIC, sizeof(MAGIC));
+    put_text(data, root);
+    put_number(data, known.size());
+    for (const auto& [path, directory] : known) {
+        put_text(data, path);
+        put_number(data, static_cast<uint64_t>(directory.seconds));
+        put_number(data, static_cast<uint64_t>(directory.nanoseconds));
+        put_number(data, directory.files.size());
+        for (const std::string& name : directory.files) {
+            put_text(data, name);
+        }
+        put_number(data, directory.directories.size());
+        for (const std::string& name : directory.directories) {
+            put_text(data, name);
+        }
+    }
+
+    std::string temp = cache + "." + std::to_string(getpid()) + "~";
+    int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(out, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    ::close(out);
+    if (done != data.size() || rename(temp.c_str(), cache.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
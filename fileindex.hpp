@@ -0,0 +1,83 @@
+#ifndef FILEINDEX_HPP
+#define FILEINDEX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+// Every path in the index, relative to its root, packed into one string.
+struct FileList {
+    std::string text;
+    std::vector<uint32_t> starts;
+
+    size_t size() const { return starts.empty() ? 0 : starts.size() - 1; }
+    std::string_view operator[](size_t i) const {
+        return std::string_view(text).substr(starts[i], starts[i + 1] - starts[i]);
+    }
+};
+
+// The files under a directory, kept between runs in the user's cache. A
+// refresh stats every directory it knows and lists only those whose mtime
+// moved, since adding, removing or renaming an entry is what changes it;
+// the rest keep the names they had. The walk runs on a pool of workers off
+// the editor's thread, and the cached list is handed over before it starts.
+class FileIndex {
+public:
+    explicit FileIndex(std::string root);
+    ~FileIndex();
+    FileIndex(const FileIndex&) = delete;
+    FileIndex& operator=(const FileIndex&) = delete;
+
+    void refresh(unsigned threads);
+    void cancel();
+    bool refreshing() const;
+    bool take(std::shared_ptr<const FileList>& files);
+    size_t listed() const;
+    size_t reused() const;
+    double seconds() const;
+
+private:
+    struct Directory {
+        int64_t seconds = -1;
+        int64_t nanoseconds = 0;
+        std::vector<std::string> files;
+        std::vector<std::string> directories;
+    };
+    using Directories = std::unordered_map<std::string, Directory>;
+
+    std::string root;
+    std::string cache;
+    Directories known;
+    bool loaded;
+    std::atomic<bool> stop;
+    std::atomic<bool> running;
+    std::atomic<size_t> listed_count;
+    std::atomic<size_t> reused_count;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point ended;
+    std::thread runner;
+
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<std::string> tasks;
+    size_t busy;
+    std::vector<std::pair<std::string, Directory>> walked;
+    std::shared_ptr<const FileList> published;
+
+    void run(unsigned threads);
+    void work();
+    bool visit(const std::string& path, Directory& directory, std::vector<std::string>& found);
+    void publish();
+    bool load();
+    bool save() const;
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "finder.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <thread>
+
+static const int SCORE_MATCH = 16;
+static const int GAP_START = -3;
+static const int GAP_EXTENSION = -1;
+static const int BONUS_START = 10;
+static const int BONUS_SEPARATOR = 9;
+static const int BONUS_BOUNDARY = 8;
+static const int BONUS_CAMEL = 7;
+static const int BONUS_CONSECUTIVE = 4;
+static const int BONUS_BASENAME = 12;
+static const size_t PARALLEL_CANDIDATES = 1 << 16;
+
+// Runs work(part, from, to) over [0, count) split between the cores, the
+// last part on the calling thread. Small inputs stay on the calling thread.
+template <typename Work>
+static unsigned split(size_t count, Work work){
+    unsigned threads = count < PARALLEL_CANDIDATES ? 1 : std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i + 1 < threads; ++i) {
+        workers.emplace_back([&work, i, chunk, count]{ work(i, std::min(count, i * chunk), std::min(count, (i + 1) * chunk)); });
+    }
+    work(threads - 1, std::min(count, (threads - 1) * chunk), count);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return threads;
+}
+
+FileFinder::FileFinder() : files(std::make_shared<FileList>()), ranked_count(0){}
+
+// A new list, e.g. after the index was refreshed; the current query is run
+// against it again.
+void FileFinder::set_files(std::shared_ptr<const FileList> list){
+    files = std::move(list);
+    folded.resize(files->text.length());
+    std::transform(files->text.begin(), files->text.end(), folded.begin(),
+                   [](char c){ return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    names.resize(files->size());
+    bonuses.resize(files->text.length());
+    split(files->size(), [this](unsigned, size_t from, size_t to){
+        for (size_t file = from; file < to; ++file) {
+            size_t begin = files->starts[file];
+            size_t end = files->starts[file + 1];
+            const void* slash = memrchr(folded.data() + begin, '/', end - begin);
+            names[file] = slash ? static_cast<uint32_t>(static_cast<const char*>(slash) - folded.data()) + 1 : static_cast<uint32_t>(begin);
+            for (size_t at = begin; at < end; ++at) {
+                bonuses[at] = static_cast<signed char>(bonus(at, begin));
+            }
+        }
+    });
+    levels.clear();
+    pattern.clear();
+    match();
+}
+
+// Spaces are left out of the match, so "src main" finds src/main.cpp.
+void FileFinder::set_query(const std::string& text){
+    if (text != query) {
+        query = text;
+        match();
+    }
+}
+
+// Keeps the levels the new pattern shares with the old one.
+void FileFinder::match(){
+    std::string next;
+    for (char c : query) {
+        if (c != ' ') {
+            next += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        }
+    }
+    size_t common = 0;
+    while (common < pattern.length() && common < next.length() && pattern[common] == next[common]) {
+        ++common;
+    }
+    levels.resize(std::min(levels.size(), common));
+    pattern = std::move(next);
+    while (levels.size() < pattern.length()) {
+        narrow();
+    }
+    ranked.clear();
+    ranked_count = 0;
+}
+
+size_t FileFinder::total() const {
+    return files->size();
+}
+
+size_t FileFinder::matched() const {
+    return levels.empty() ? files->size() : levels.back().size();
+}
+
+// Adds the level for the next character of the pattern: each file still in
+// the running is searched for it after where its match ended so far.
+void FileFinder::narrow(){
+    char c = pattern[levels.size()];
+    const char* text = folded.data();
+    const std::vector<uint32_t>& starts = files->starts;
+    const std::vector<Candidate>* previous = levels.empty() ? nullptr : &levels.back();
+    size_t count = previous ? previous->size() : files->size();
+    std::vector<std::vector<Candidate>> parts(std::max(1u, std::thread::hardware_concurrency()));
+    unsigned used = split(count, [&](unsigned part, size_t from, size_t to){
+        std::vector<Candidate>& found = parts[part];
+        found.reserve(to - from);
+        for (size_t i = from; i < to; ++i) {
+            uint32_t file = previous ? (*previous)[i].file : static_cast<uint32_t>(i);
+            uint32_t at = previous ? (*previous)[i].end : starts[file];
+            const void* hit = memchr(text + at, c, starts[file + 1] - at);
+            if (hit) {
+                found.push_back({file, static_cast<uint32_t>(static_cast<const char*>(hit) - text + 1)});
+            }
+        }
+    });
+    if (used == 1) {
+        levels.push_back(std::move(parts[0]));
+        return;
+    }
+    std::vector<Candidate> next;
+    for (unsigned part = 0; part < used; ++part) {
+        next.insert(next.end(), parts[part].begin(), parts[part].end());
+    }
+    levels.push_back(std::move(next));
+}
+
+size_t FileFinder::length(uint32_t file) const {
+    return files->starts[file + 1] - files->starts[file];
+}
+
+// Higher scores first, then shorter paths, then the order of the list.
+bool FileFinder::better(const FinderMatch& a, const FinderMatch& b) const {
+    if (a.score != b.score) {
+        return a.score > b.score;
+    }
+    if (length(a.file) != length(b.file)) {
+        return length(a.file) < length(b.file);
+    }
+    return a.file < b.file;
+}
+
+// The best count matches, best first. Scoring is spread over threads when
+// a short query leaves most of a large tree in the running.
+const std::vector<FinderMatch>& FileFinder::best(size_t count){
+    if (ranked_count == count) {
+        return ranked;
+    }
+    ranked_count = count;
+    ranked.clear();
+    if (levels.empty()) {
+        for (uint32_t file = 0; file < files->size() && ranked.size() < count; ++file) {
+            ranked.push_back({file, 0});
+        }
+        return ranked;
+    }
+
+    const std::vector<Candidate>& candidates = levels.back();
+    std::vector<std::vector<FinderMatch>> parts(std::max(1u, std::thread::hardware_concurrency()));
+    unsigned used = split(candidates.size(), [&](unsigned part, size_t from, size_t to){
+        rank(candidates.data() + from, candidates.data() + to, count, parts[part]);
+    });
+    if (used == 1) {
+        ranked.swap(parts[0]);
+        return ranked;
+    }
+    for (unsigned part = 0; part < used; ++part) {
+        ranked.insert(ranked.end(), parts[part].begin(), parts[part].end());
+    }
+    size_t kept = std::min(count, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(),
+                      [this](const FinderMatch& a, const FinderMatch& b){ return better(a, b); });
+    ranked.resize(kept);
+    return ranked;
+}
+
+// Keeps the best count of the candidates in a heap whose top is the worst
+// kept. Once it is full, a candidate whose best possible score could not
+// beat the worst is not scored; short queries in a large tree fill the heap
+// with such scores quickly, so most of their candidates are skipped.
+void FileFinder::rank(const Candidate* from, const Candidate* to, size_t count, std::vector<FinderMatch>& out) const {
+    auto order = [this](const FinderMatch& a, const FinderMatch& b){ return better(a, b); };
+    int m = static_cast<int>(pattern.length());
+    // within a name the first match gets at most the separator bonus, doubled,
+    // and the others at most a word boundary; a path that is only a name can
+    // start with the pattern
+    int in_name = BONUS_BASENAME + m * SCORE_MATCH + 2 * BONUS_SEPARATOR + (m - 1) * BONUS_BOUNDARY;
+    int at_start = BONUS_BASENAME + m * SCORE_MATCH + 2 * BONUS_START + (m - 1) * BONUS_BOUNDARY;
+    int in_path = m * SCORE_MATCH + 2 * BONUS_START + (m - 1) * BONUS_SEPARATOR;
+    out.clear();
+    out.reserve(count);
+    for (const Candidate* candidate = from; candidate != to; ++candidate) {
+        uint32_t file = candidate->file;
+        if (out.size() == count) {
+            if (count == 0) {
+                break;
+            }
+            const FinderMatch& worst = out.front();
+            int ceiling = names[file] == files->starts[file] ? at_start : std::max(in_name, in_path);
+            if (ceiling < worst.score || (ceiling == worst.score && length(file) >= length(worst.file))) {
+                continue;
+            }
+        }
+        FinderMatch match {file, score(file, candidate->end, nullptr)};
+        if (out.size() < count) {
+            out.push_back(match);
+            std::push_heap(out.begin(), out.end(), order);
+        } else if (better(match, out.front())) {
+            std::pop_heap(out.begin(), out.end(), order);
+            out.back() = match;
+            std::push_heap(out.begin(), out.end(), order);
+        }
+    }
+    std::sort_heap(out.begin(), out.end(), order);
+}
+
+std::string_view FileFinder::path(uint32_t file) const {
+    return (*files)[file];
+}
+
+// The byte offsets of the matched characters within the path, to draw them.
+void FileFinder::positions(uint32_t file, std::vector<size_t>& at) const {
+    at.clear();
+    if (pattern.empty()) {
+        return;
+    }
+    size_t begin = files->starts[file];
+    size_t end = begin;
+    for (char c : pattern) {
+        end = static_cast<size_t>(static_cast<const char*>(memchr(folded.data() + end, c, files->starts[file + 1] - end)) -
+                                  folded.data()) + 1;
+    }
+    score(file, static_cast<uint32_t>(end), &at);
+}
+
+// The match scored is the shortest one ending where the leftmost match ends,
+// or, when that starts in a directory, the same inside the file name if the
+// pattern fits there: typing a name should find it even when a directory
+// matches first.
+int FileFinder::score(uint32_t file, uint32_t end, std::vector<size_t>* at) const {
+    const char* text = folded.data();
+    size_t begin = files->starts[file];
+    size_t stop = files->starts[file + 1];
+    size_t name = names[file];
+
+    std::vector<size_t> first;
+    size_t start;
+    int best = score_match(end, begin, name, start, at ? &first : nullptr);
+    if (start < name) {
+        size_t cursor = name;
+        size_t k = 0;
+        for (; cursor < stop && k < pattern.length(); ++cursor) {
+            if (text[cursor] == pattern[k]) {
+                ++k;
+            }
+        }
+        if (k == pattern.length()) {
+            std::vector<size_t> second;
+            int in_name = score_match(cursor, begin, name, start, at ? &second : nullptr);
+            if (in_name > best) {
+                best = in_name;
+                first.swap(second);
+            }
+        }
+    }
+    if (at) {
+        at->swap(first);
+    }
+    return best;
+}
+
+// Scores the match that ends at end, taking each character as late as it
+// can so the match is as short as it can be. It is walked backwards; a
+// character's bonus is added once the one before it is found, as that
+// decides whether the two are consecutive.
+int FileFinder::score_match(size_t end, size_t begin, size_t name, size_t& start, std::vector<size_t>* at) const {
+    const char* text = folded.data();
+    int total = 0;
+    size_t next = SIZE_MAX;
+    size_t here = end;
+    for (size_t k = pattern.length(); k-- > 0; ) {
+        do {
+            --here;
+        } while (text[here] != pattern[k]);
+        if (next != SIZE_MAX) {
+            int extra = bonuses[next];
+            if (next == here + 1) {
+                extra = std::max(extra, BONUS_CONSECUTIVE);
+            } else {
+                total += GAP_START + static_cast<int>(next - here - 2) * GAP_EXTENSION;
+            }
+            total += SCORE_MATCH + extra;
+        }
+        if (at) {
+            at->push_back(here - begin);
+        }
+        next = here;
+    }
+    start = here;
+    total += SCORE_MATCH + 2 * bonuses[here];
+    if (here >= name) {
+        total += BONUS_BASENAME;
+    }
+    if (at) {
+        std::reverse(at->begin(), at->end());
+    }
+    return total;
+}
+
+// Matches at the start of a word count for more: after a slash, after
+// punctuation, or at a lower to upper case change.
+int FileFinder::bonus(size_t at, size_t begin) const {
+    if (at == begin) {
+        return BONUS_START;
+    }
+    unsigned char before = static_cast<unsigned char>(files->text[at - 1]);
+    unsigned char here = static_cast<unsigned char>(files->text[at]);
+    if (before == '/') {
+        return BONUS_SEPARATOR;
+    }
+    if (before == '_' || before == '-' || before == '.' || before == ' ') {
+        return BONUS_BOUNDARY;
+    }
+    if ((islower(before) && isupper(here)) || (!isdigit(before) && isdigit(here))) {
+        return BONUS_CAMEL;
+    }
+    return 0;
+}
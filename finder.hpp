@@ -0,0 +1,60 @@
+#ifndef FINDER_HPP
+#define FINDER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "fileindex.hpp"
+
+struct FinderMatch {
+    uint32_t file;
+    int score;
+};
+
+// Fuzzy matches a query against a file list: the query's characters must
+// appear in the path in order, ignoring case. Each typed character narrows
+// the files that matched the query before it, keeping where the match got
+// to, so a keystroke only looks at what is left; deleting one drops back to
+// the list kept for the shorter query. Only the files still in the running
+// are scored, and only the best few are sorted.
+class FileFinder {
+public:
+    FileFinder();
+
+    void set_files(std::shared_ptr<const FileList> files);
+    void set_query(const std::string& query);
+    size_t total() const;
+    size_t matched() const;
+    const std::vector<FinderMatch>& best(size_t count);
+    std::string_view path(uint32_t file) const;
+    void positions(uint32_t file, std::vector<size_t>& at) const;
+
+private:
+    struct Candidate {
+        uint32_t file;
+        uint32_t end;
+    };
+
+    std::shared_ptr<const FileList> files;
+    std::string folded;
+    std::vector<uint32_t> names;
+    std::vector<signed char> bonuses;
+    std::string query;
+    std::string pattern;
+    std::vector<std::vector<Candidate>> levels;
+    std::vector<FinderMatch> ranked;
+    size_t ranked_count;
+
+    void match();
+    void narrow();
+    int score(uint32_t file, uint32_t end, std::vector<size_t>* at) const;
+    int score_match(size_t end, size_t begin, size_t name, size_t& start, std::vector<size_t>* at) const;
+    int bonus(size_t at, size_t begin) const;
+    void rank(const Candidate* from, const Candidate* to, size_t count, std::vector<FinderMatch>& out) const;
+    size_t length(uint32_t file) const;
+    bool better(const FinderMatch& a, const FinderMatch& b) const;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "follow.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t WATCHED = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+
+Follower::Follower() : notify(-1), fd(-1), offset(0), changed(false), reopen(false), partial(true){}
+
+Follower::~Follower(){
+    stop();
+}
+
+// Starts watching with the first offset bytes already in the buffer.
+bool Follower::start(const std::string& file, uint64_t from){
+    stop();
+    path = file;
+    notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify < 0 || !attach()) {
+        stop();
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < from) {
+        from = 0;
+    }
+    offset = from;
+    partial = true;
+    char last;
+    if (offset > 0 && pread(fd, &last, 1, static_cast<off_t>(offset - 1)) == 1) {
+        partial = last != '\n';
+    }
+    // whatever was written between loading and now is picked up at once
+    changed = true;
+    return true;
+}
+
+void Follower::stop(){
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    if (notify >= 0) {
+        close(notify);
+        notify = -1;
+    }
+    changed = false;
+    reopen = false;
+}
+
+bool Follower::active() const {
+    return notify >= 0;
+}
+
+// More is known to be waiting than the last poll was allowed to read.
+bool Follower::behind() const {
+    return changed || reopen;
+}
+
+// Whether the last byte read was not a line break, so the next bytes go on
+// the end of the buffer's last line.
+bool Follower::open_line() const {
+    return partial;
+}
+
+bool Follower::attach(){
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (inotify_add_watch(notify, path.c_str(), WATCHED) < 0) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void Follower::drain(){
+    alignas(inotify_event) char events[4096];
+    for (;;) {
+        ssize_t n = read(notify, events, sizeof(events));
+        if (n <= 0) {
+            return;
+        }
+        for (ssize_t at = 0; at < n;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(events + at);
+            if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+                reopen = true;
+            }
+            changed = true;
+            at += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+    }
+}
+
+uint64_t Follower::position() const {
+    return offset;
+}
+
+// Reads up to limit new bytes into data. RESTARTED means the file was
+// truncated or replaced and data holds the start of its new contents.
+Follower::Change Follower::poll(std::string& data, size_t limit){
+    data.clear();
+    if (!active()) {
+        return NONE;
+    }
+    drain();
+    Change change = APPENDED;
+    if (reopen) {
+        int old = fd;
+        fd = -1;
+        if (!attach()) {
+            fd = old;
+            return NONE;
+        }
+        close(old);
+        reopen = false;
+        offset = 0;
+        change = RESTARTED;
+    }
+    if (!changed) {
+        return NONE;
+    }
+    changed = false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NONE;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    if (size < offset) {
+        offset = 0;
+        change = RESTARTED;
+    }
+    if (change == RESTARTED) {
+        partial = true;
+    }
+    size_t want = static_cast<size_t>(std::min<uint64_t>(size - offset, limit));
+    data.resize(want);
+    size_t done = 0;
+    while (done < want) {
+        ssize_t n = pread(fd, &data[done], want - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += static_cast<size_t>(n);
+    }
+    data.resize(done);
+    offset += done;
+    changed = offset < size;
+    if (!data.empty()) {
+        partial = data.back() != '\n';
+    }
+    return data.empty() && change == APPENDED ? NONE : change;
+}
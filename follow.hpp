@@ -0,0 +1,41 @@
+#ifndef FOLLOW_HPP
+#define FOLLOW_HPP
+
+#include <string>
+#include <cstdint>
+
+// Watches a file that is being written to, like tail -f. inotify says when
+// it changed, so an idle poll costs one non-blocking read; only the bytes
+// past the last offset are read. A file that shrinks or is replaced (log
+// rotation) is read again from the start.
+class Follower {
+public:
+    enum Change { NONE, APPENDED, RESTARTED };
+
+    Follower();
+    ~Follower();
+    Follower(const Follower&) = delete;
+    Follower& operator=(const Follower&) = delete;
+
+    bool start(const std::string& file, uint64_t offset);
+    void stop();
+    bool active() const;
+    bool behind() const;
+    bool open_line() const;
+    uint64_t position() const;
+    Change poll(std::string& data, size_t limit);
+
+private:
+    std::string path;
+    int notify;
+    int fd;
+    uint64_t offset;
+    bool changed;
+    bool reopen;
+    bool partial;
+
+    bool attach();
+    void drain();
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "grep.hpp"
+#include "search.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const size_t BINARY_PROBE = 8192;
+static const size_t HIT_TEXT = 256;
+static const size_t READ_LIMIT = 1 << 20;
+
+GrepJob::GrepJob(std::string root, std::string needle, unsigned threads)
+    : root(std::move(root)), needle(std::move(needle)), threads(std::max(threads, 1u)),
+      stop(false), running(0), scanned(0), matched(0), busy(0){}
+
+GrepJob::~GrepJob(){
+    cancel();
+}
+
+void GrepJob::start(){
+    started = std::chrono::steady_clock::now();
+    std::error_code error;
+    tasks.push_back({root, fs::is_directory(root, error)});
+    running = threads;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back([this]{ work(); });
+    }
+}
+
+void GrepJob::cancel(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    ready.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+bool GrepJob::done() const {
+    return running.load(std::memory_order_acquire) == 0;
+}
+
+// Moves the hits found since the last call into hits, in the order the
+// workers finished their files.
+bool GrepJob::take(std::vector<GrepHit>& hits){
+    std::lock_guard<std::mutex> guard(lock);
+    if (pending.empty()) {
+        return false;
+    }
+    if (hits.empty()) {
+        hits.swap(pending);
+    } else {
+        std::move(pending.begin(), pending.end(), std::back_inserter(hits));
+        pending.clear();
+    }
+    return true;
+}
+
+size_t GrepJob::files() const {
+    return scanned.load(std::memory_order_relaxed);
+}
+
+size_t GrepJob::found() const {
+    return matched.load(std::memory_order_relaxed);
+}
+
+double GrepJob::seconds() const {
+    auto end = done() ? ended : std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - started).count();
+}
+
+// Tasks are taken from the top of the stack, so the walk goes depth first
+// and the stack stays about as deep as the tree. The search is over when the
+// stack is empty and no worker holds a task that could add to it.
+void GrepJob::work(){
+    std::vector<Task> found;
+    std::vector<GrepHit> hits;
+    std::string buffer;
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this]{ return stop || !tasks.empty() || busy == 0; });
+            if (stop || tasks.empty()) {
+                break;
+            }
+            task = std::move(tasks.back());
+            tasks.pop_back();
+            ++busy;
+        }
+
+        if (task.directory) {
+            list(task.path, found);
+        } else {
+            scan(task.path, buffer, hits);
+        }
+
+        bool idle;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            --busy;
+            std::move(found.begin(), found.end(), std::back_inserter(tasks));
+            std::move(hits.begin(), hits.end(), std::back_inserter(pending));
+            idle = busy == 0 && tasks.empty();
+        }
+        if (idle || found.size() > 1) {
+            ready.notify_all();
+        } else if (!found.empty()) {
+            ready.notify_one();
+        }
+        found.clear();
+        hits.clear();
+    }
+    if (running.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        ended = std::chrono::steady_clock::now();
+    }
+}
+
+// Version control metadata is never searched; symlinks are not followed.
+void GrepJob::list(const std::string& path, std::vector<Task>& found){
+    std::error_code error;
+    for (fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, error), end;
+         !error && it != end; it.increment(error)) {
+        // the type comes from the directory entry, so nothing is stat'ed
+        if (it->is_symlink(error) || error) {
+            error.clear();
+            continue;
+        }
+        std::string name = it->path().filename().string();
+        if (it->is_directory(error)) {
+            if (name != ".git" && name != ".hg" && name != ".svn") {
+                found.push_back({it->path().string(), true});
+            }
+        } else if (it->is_regular_file(error)) {
+            found.push_back({it->path().string(), false});
+        }
+    }
+}
+
+// Small files are read into the worker's buffer, which costs less than
+// mapping them; larger ones are mapped. Files with a NUL byte near the start
+// are binary and skipped, as grep -I does.
+void GrepJob::scan(const std::string& path, std::string& buffer, std::vector<GrepHit>& hits){
+    scanned.fetch_add(1, std::memory_order_relaxed);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return;
+    }
+    size_t length = static_cast<size_t>(st.st_size);
+    if (length <= READ_LIMIT) {
+        if (buffer.size() < length) {
+            buffer.resize(std::max(length, buffer.size() * 2));
+        }
+        size_t done = 0;
+        while (done < length) {
+            ssize_t n = ::read(fd, &buffer[done], length - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        search(path, buffer.data(), buffer.data() + done, hits);
+        return;
+    }
+    void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+    search(path, static_cast<const char*>(map), static_cast<const char*>(map) + length, hits);
+    munmap(map, length);
+}
+
+// Searches the file as one block; lines are only counted up to each hit, so
+// files without one are never split into lines.
+void GrepJob::search(const std::string& path, const char* begin, const char* end, std::vector<GrepHit>& hits){
+    size_t length = static_cast<size_t>(end - begin);
+    if (memchr(begin, 0, std::min(length, BINARY_PROBE))) {
+        return;
+    }
+    std::string shown;
+    const char* counted = begin;
+    size_t line = 1;
+    for (const char* hit = find_text(begin, end, needle); hit && !stop.load(std::memory_order_relaxed);
+         hit = find_text(hit, end, needle)) {
+        for (const char* p = counted; (p = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(hit - p)))); ++p) {
+            ++line;
+        }
+        const void* before = memrchr(begin, '\n', static_cast<size_t>(hit - begin));
+        const char* line_start = before ? static_cast<const char*>(before) + 1 : begin;
+        const void* after = memchr(hit, '\n', static_cast<size_t>(end - hit));
+        const char* line_end = after ? static_cast<const char*>(after) : end;
+        size_t shown_length = std::min(static_cast<size_t>(line_end - line_start), HIT_TEXT);
+        if (shown.empty()) {
+            shown = path.compare(0, 2, "./") == 0 ? path.substr(2) : path;
+        }
+        hits.push_back({shown, line, std::string(line_start, shown_length)});
+        matched.fetch_add(1, std::memory_order_relaxed);
+        // one hit per line, like grep
+        counted = line_end;
+        hit = line_end;
+    }
+}
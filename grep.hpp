@@ -0,0 +1,67 @@
+#ifndef GREP_HPP
+#define GREP_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+struct GrepHit {
+    std::string path;
+    size_t line;
+    std::string text;
+};
+
+// Searches every file under a directory for a literal string. A pool of
+// workers shares one stack of tasks: a directory task lists its entries as
+// new tasks and a file task reads the file and scans it with find_text, so
+// the walk and the scans overlap. Hits are handed over through take() while
+// the search runs.
+class GrepJob {
+public:
+    GrepJob(std::string root, std::string needle, unsigned threads);
+    ~GrepJob();
+    GrepJob(const GrepJob&) = delete;
+    GrepJob& operator=(const GrepJob&) = delete;
+
+    void start();
+    void cancel();
+    bool done() const;
+    bool take(std::vector<GrepHit>& hits);
+    size_t files() const;
+    size_t found() const;
+    double seconds() const;
+
+private:
+    struct Task {
+        std::string path;
+        bool directory;
+    };
+
+    std::string root;
+    std::string needle;
+    unsigned threads;
+    std::atomic<bool> stop;
+    std::atomic<unsigned> running;
+    std::atomic<size_t> scanned;
+    std::atomic<size_t> matched;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point ended;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<Task> tasks;
+    size_t busy;
+    std::vector<GrepHit> pending;
+    std::vector<std::thread> workers;
+
+    void work();
+    void list(const std::string& path, std::vector<Task>& found);
+    void scan(const std::string& path, std::string& buffer, std::vector<GrepHit>& hits);
+    void search(const std::string& path, const char* begin, const char* end, std::vector<GrepHit>& hits);
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "history.hpp"
+#include "clip.hpp"
+#include <utility>
+
+History::History(size_t limit) : bytes(0), limit(limit), open(false){}
+
+size_t History::cost(const Edit& edit){
+    return sizeof(Edit) + edit.removed.length() + edit.inserted.length() +
+           (edit.removed_clip ? edit.removed_clip->footprint() : 0) +
+           (edit.inserted_clip ? edit.inserted_clip->footprint() : 0);
+}
+
+// The chunks behind the clips of the history are counted by slice, so that
+// orphaned() can tell which of them nothing else holds.
+void History::hold(const Edit& edit){
+    hold(edit.removed_clip);
+    hold(edit.inserted_clip);
+}
+
+void History::hold(const std::shared_ptr<const Clip>& clip){
+    if (!clip || clips[clip.get()]++ > 0) return;
+    for (const Slice& slice : clip->lines()) {
+        Held& held = chunks[slice.chunk.get()];
+        held.chunk = slice.chunk;
+        ++held.slices;
+    }
+}
+
+void History::release(const Edit& edit){
+    release(edit.removed_clip);
+    release(edit.inserted_clip);
+}
+
+void History::release(const std::shared_ptr<const Clip>& clip){
+    if (!clip) return;
+    auto found = clips.find(clip.get());
+    if (--found->second > 0) return;
+    clips.erase(found);
+    for (const Slice& slice : clip->lines()) {
+        auto held = chunks.find(slice.chunk.get());
+        if (--held->second.slices == 0) {
+            chunks.erase(held);
+        }
+    }
+}
+
+void History::forget_undone(){
+    for (const Edit& edit : undone) {
+        release(edit);
+    }
+    undone.clear();
+}
+
+// Bytes of the chunks that only the history still holds, as when a large
+// pasted block has been cut again. They are charged only once the buffer
+// lets go of them, since until then undo costs nothing extra to keep them.
+size_t History::orphaned() const {
+    size_t total = 0;
+    for (const auto& entry : chunks) {
+        const Held& held = entry.second;
+        if (static_cast<size_t>(held.chunk.use_count()) == held.slices) {
+            total += entry.first->footprint();
+        }
+    }
+    return total;
+}
+
+// Folds a keystroke into the previous entry when it continues the same run
+// of typing or backspacing on one line.
+bool History::absorb(const Edit& edit){
+    if (!open || done.empty()) return false;
+    Edit& last = done.back();
+    if (edit.y != last.y) return false;
+    if (edit.removed_clip || edit.inserted_clip || last.removed_clip || last.inserted_clip) return false;
+    if (edit.inserted.find('\n') != std::string::npos || edit.removed.find('\n') != std::string::npos) return false;
+
+    if (edit.removed.empty() && last.removed.empty() && edit.x == last.x + last.inserted.length()) {
+        bytes -= cost(last);
+        last.inserted += edit.inserted;
+        bytes += cost(last);
+        return true;
+    }
+    if (edit.inserted.empty() && last.inserted.empty() && edit.x + edit.removed.length() == last.x) {
+        bytes -= cost(last);
+        last.removed.insert(0, edit.removed);
+        last.x = edit.x;
+        bytes += cost(last);
+        return true;
+    }
+    return false;
+}
+
+void History::record(Edit edit){
+    forget_undone();
+    if (!absorb(edit)) {
+        bytes += cost(edit);
+        hold(edit);
+        done.push_back(std::move(edit));
+    }
+    open = true;
+    trim();
+}
+
+// Records edits that are undone and redone together as one step; every entry
+// after the first is joined to the one before it.
+void History::record_group(std::vector<Edit> edits){
+    if (edits.empty()) return;
+    forget_undone();
+    for (size_t i = 0; i < edits.size(); ++i) {
+        edits[i].joined = i > 0;
+        bytes += cost(edits[i]);
+        hold(edits[i]);
+        done.push_back(std::move(edits[i]));
+    }
+    open = false;
+    trim();
+}
+
+// Drops the oldest steps while over the limit, always keeping the newest one.
+void History::trim(){
+    while (bytes + orphaned() > limit && !done.empty()) {
+        size_t step = 1;
+        while (step < done.size() && done[step].joined) ++step;
+        if (step == done.size()) break;
+        for (; step > 0; --step) {
+            bytes -= cost(done.front());
+            release(done.front());
+            done.pop_front();
+        }
+    }
+}
+
+// Hands back the entries of one step in the order they must be reverted.
+bool History::undo(std::vector<Edit>& edits){
+    open = false;
+    edits.clear();
+    if (done.empty()) return false;
+    bool joined = true;
+    while (joined && !done.empty()) {
+        edits.push_back(std::move(done.back()));
+        done.pop_back();
+        bytes -= cost(edits.back());
+        undone.push_back(edits.back());
+        joined = edits.back().joined;
+    }
+    return true;
+}
+
+bool History::redo(std::vector<Edit>& edits){
+    open = false;
+    edits.clear();
+    if (undone.empty()) return false;
+    do {
+        edits.push_back(std::move(undone.back()));
+        undone.pop_back();
+        bytes += cost(edits.back());
+        done.push_back(edits.back());
+    } while (!undone.empty() && undone.back().joined);
+    return true;
+}
+
+size_t History::footprint() const {
+    return bytes + orphaned();
+}
+
+void History::seal(){
+    open = false;
+}
+
+void History::clear(){
+    done.clear();
+    undone.clear();
+    clips.clear();
+    chunks.clear();
+    bytes = 0;
+    open = false;
+}
@@ -0,0 +1,62 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+class Clip;
+class Chunk;
+
+// A clip, when set, stands in for the string on its side so that large
+// yanked or cut regions are journaled without copying them.
+struct Edit {
+    size_t y = 0;
+    size_t x = 0;
+    std::string removed;
+    std::string inserted;
+    std::shared_ptr<const Clip> removed_clip;
+    std::shared_ptr<const Clip> inserted_clip;
+    bool joined = false;
+};
+
+class History {
+public:
+    explicit History(size_t limit = 64 << 20);
+
+    void record(Edit edit);
+    void record_group(std::vector<Edit> edits);
+    bool undo(std::vector<Edit>& edits);
+    bool redo(std::vector<Edit>& edits);
+    void seal();
+    void clear();
+    size_t footprint() const;
+
+private:
+    struct Held {
+        std::weak_ptr<Chunk> chunk;
+        size_t slices;
+    };
+
+    std::deque<Edit> done;
+    std::vector<Edit> undone;
+    std::unordered_map<const Clip*, size_t> clips;
+    std::unordered_map<const Chunk*, Held> chunks;
+    size_t bytes;
+    size_t limit;
+    bool open;
+
+    static size_t cost(const Edit& edit);
+    void hold(const Edit& edit);
+    void hold(const std::shared_ptr<const Clip>& clip);
+    void release(const Edit& edit);
+    void release(const std::shared_ptr<const Clip>& clip);
+    void forget_undone();
+    size_t orphaned() const;
+    bool absorb(const Edit& edit);
+    void trim();
+};
+
+#endif
@@ -0,0 +1,331 @@
+#include "journal.hpp"
+#include "clip.hpp"
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char MAGIC[8] = {'S', 'H', 'A', 'R', 'D', 'J', '1', '\n'};
+static const size_t HEADER_BYTES = sizeof(MAGIC) + 3 * sizeof(uint64_t);
+static const size_t RECORD_BYTES = 4 * sizeof(uint64_t);
+
+// The size and modification time of the file the edits apply to; a journal
+// is only replayed onto the same version of the file it was written against.
+static void identify(const std::string& file, uint64_t base[3]){
+    struct stat st;
+    if (stat(file.c_str(), &st) == 0) {
+        base[0] = static_cast<uint64_t>(st.st_size);
+        base[1] = static_cast<uint64_t>(st.st_mtim.tv_sec);
+        base[2] = static_cast<uint64_t>(st.st_mtim.tv_nsec);
+    } else {
+        base[0] = base[1] = base[2] = 0;
+    }
+}
+
+static void put_number(std::string& out, uint64_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static uint64_t get_number(const char* in){
+    uint64_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+static void put_header(std::string& out, const std::string& file){
+    uint64_t base[3];
+    identify(file, base);
+    out.append(MAGIC, sizeof(MAGIC));
+    for (uint64_t part : base) {
+        put_number(out, part);
+    }
+}
+
+// Each record is y, x and the lengths of both sides, then the removed and
+// the inserted text.
+static void put_edit(std::string& out, const Edit& edit){
+    std::string removed_text, inserted_text;
+    const std::string* removed = &edit.removed;
+    const std::string* inserted = &edit.inserted;
+    if (edit.removed_clip) {
+        removed_text = edit.removed_clip->text();
+        removed = &removed_text;
+    }
+    if (edit.inserted_clip) {
+        inserted_text = edit.inserted_clip->text();
+        inserted = &inserted_text;
+    }
+    put_number(out, edit.y);
+    put_number(out, edit.x);
+    put_number(out, removed->length());
+    put_number(out, inserted->length());
+    out += *removed;
+    out += *inserted;
+}
+
+static bool write_all(int fd, const std::string& data){
+    size_t done = 0;
+    while (done < data.length()) {
+        ssize_t n = write(fd, data.data() + done, data.length() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+Journal::Journal()
+    : fd(-1), end(0), interval(1000), running(false), retaining(false), restarting(false), restart_at(0){}
+
+Journal::~Journal(){
+    stop(false);
+}
+
+std::string Journal::path_for(const std::string& file){
+    return file + ".shard-journal";
+}
+
+// Reads every complete record of the journal kept for the file; a record cut
+// short by a crash ends the list. current tells whether the file on disk is
+// still the version the edits were made against.
+bool Journal::read(const std::string& file, std::vector<Edit>& edits, bool& current){
+    edits.clear();
+    current = false;
+    int in = ::open(path_for(file).c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    std::string data;
+    struct stat st;
+    if (fstat(in, &st) == 0) {
+        data.resize(static_cast<size_t>(st.st_size));
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = ::read(in, &data[done], data.size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += static_cast<size_t>(n);
+        }
+        data.resize(done);
+    }
+    ::close(in);
+    if (data.size() < HEADER_BYTES || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+
+    uint64_t base[3];
+    identify(file, base);
+    current = true;
+    for (size_t i = 0; i < 3; ++i) {
+        current = current && get_number(data.data() + sizeof(MAGIC) + i * sizeof(uint64_t)) == base[i];
+    }
+
+    size_t offset = HEADER_BYTES;
+    while (data.size() - offset >= RECORD_BYTES) {
+        const char* record = data.data() + offset;
+        uint64_t removed = get_number(record + 2 * sizeof(uint64_t));
+        uint64_t inserted = get_number(record + 3 * sizeof(uint64_t));
+        size_t left = data.size() - offset - RECORD_BYTES;
+        if (removed > left || inserted > left - removed) {
+            break;
+        }
+        Edit edit;
+        edit.y = get_number(record);
+        edit.x = get_number(record + sizeof(uint64_t));
+        edit.removed.assign(record + RECORD_BYTES, removed);
+        edit.inserted.assign(record + RECORD_BYTES + removed, inserted);
+        edits.push_back(std::move(edit));
+        offset += RECORD_BYTES + removed + inserted;
+    }
+    return true;
+}
+
+void Journal::discard(const std::string& file){
+    unlink(path_for(file).c_str());
+}
+
+// Opens the journal for the file, either fresh against the file as it is on
+// disk now or to go on after the records already in it.
+bool Journal::start(const std::string& file, bool append, unsigned interval_ms){
+    stop(false);
+    this->file = file;
+    path = path_for(file);
+    interval = interval_ms;
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0600);
+    if (fd < 0) {
+        return false;
+    }
+    std::string header;
+    if (!append) {
+        put_header(header, file);
+    }
+    struct stat st;
+    if (!write_all(fd, header) || fstat(fd, &st) != 0) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    end = st.st_size;
+    running = true;
+    writer = std::thread([this]{ write_loop(); });
+    return true;
+}
+
+// Writes out what is queued and closes the journal; it is removed when the
+// editor exits cleanly, so only a crash leaves one behind.
+void Journal::stop(bool remove){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    wake.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+        if (remove) {
+            unlink(path.c_str());
+        }
+    }
+    pending.clear();
+    retained.clear();
+    retaining = false;
+}
+
+bool Journal::active() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return fd >= 0;
+}
+
+void Journal::set_interval(unsigned interval_ms){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        interval = interval_ms;
+    }
+    wake.notify_one();
+}
+
+// Queues an edit the way it was applied: an undone edit goes in with its
+// sides swapped, so replay only ever applies records forward.
+void Journal::append(const Edit& edit, bool forward){
+    std::lock_guard<std::mutex> guard(lock);
+    if (!running) {
+        return;
+    }
+    Edit entry;
+    entry.y = edit.y;
+    entry.x = edit.x;
+    entry.removed = forward ? edit.removed : edit.inserted;
+    entry.inserted = forward ? edit.inserted : edit.removed;
+    entry.removed_clip = forward ? edit.removed_clip : edit.inserted_clip;
+    entry.inserted_clip = forward ? edit.inserted_clip : edit.removed_clip;
+    if (retaining) {
+        retained.push_back(entry);
+    }
+    pending.push_back(std::move(entry));
+}
+
+// Called when a save takes its snapshot: edits from here on are kept so the
+// journal can be started over from them once the save has landed.
+void Journal::checkpoint(){
+    std::lock_guard<std::mutex> guard(lock);
+    retaining = true;
+    retained.clear();
+}
+
+void Journal::cancel_checkpoint(){
+    std::lock_guard<std::mutex> guard(lock);
+    retaining = false;
+    retained.clear();
+}
+
+// Called once the save is on disk: the writer replaces the journal with one
+// against the saved file holding only the edits made since the checkpoint.
+void Journal::restart(){
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running || !retaining) {
+            return;
+        }
+        restart_edits.swap(retained);
+        retained.clear();
+        retaining = false;
+        restarting = true;
+        restart_at = pending.size();
+    }
+    wake.notify_one();
+}
+
+void Journal::write_loop(){
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait_for(guard, std::chrono::milliseconds(interval), [this]{ return !running || restarting; });
+        bool stopping = !running;
+        bool restart = restarting;
+        size_t from = restart_at;
+        std::vector<Edit> batch;
+        std::vector<Edit> first;
+        batch.swap(pending);
+        if (restart) {
+            first.swap(restart_edits);
+            restarting = false;
+        }
+        guard.unlock();
+
+        if (restart) {
+            rewrite(first, batch, from);
+        } else if (!batch.empty()) {
+            std::string data;
+            for (const Edit& edit : batch) {
+                put_edit(data, edit);
+            }
+            // a record cut short, as by a full disk, would end the replay
+            // there and hide every record written after it
+            if (write_all(fd, data)) {
+                end += static_cast<off_t>(data.length());
+                fdatasync(fd);
+            } else if (ftruncate(fd, end) != 0) {
+                end = lseek(fd, 0, SEEK_END);
+            }
+        }
+
+        guard.lock();
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+// Builds the new journal beside the old one and renames it over, so a crash
+// at any point leaves one complete journal.
+bool Journal::rewrite(const std::vector<Edit>& first, const std::vector<Edit>& rest, size_t from){
+    std::string temp = path + "~";
+    int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) {
+        return false;
+    }
+    std::string data;
+    put_header(data, file);
+    for (const Edit& edit : first) {
+        put_edit(data, edit);
+    }
+    for (size_t i = from; i < rest.size(); ++i) {
+        put_edit(data, rest[i]);
+    }
+    if (!write_all(out, data) || fsync(out) != 0 || rename(temp.c_str(), path.c_str()) != 0) {
+        ::close(out);
+        unlink(temp.c_str());
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    ::close(fd);
+    fd = out;
+    end = static_cast<off_t>(data.length());
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <sys/types.h>
+#include "history.hpp"
+
+// Append-only log of the edits made since the file was last saved, kept next
+// to it so they can be replayed after a crash. The editor only queues edits;
+// a writer thread batches them into the file and fsyncs it every interval.
+class Journal {
+public:
+    Journal();
+    ~Journal();
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    static std::string path_for(const std::string& file);
+    static bool read(const std::string& file, std::vector<Edit>& edits, bool& current);
+    static void discard(const std::string& file);
+
+    bool start(const std::string& file, bool append, unsigned interval_ms);
+    void stop(bool remove);
+    bool active() const;
+    void set_interval(unsigned interval_ms);
+    void append(const Edit& edit, bool forward);
+    void checkpoint();
+    void cancel_checkpoint();
+    void restart();
+
+private:
+    std::string file;
+    std::string path;
+    int fd;
+    off_t end;
+    unsigned interval;
+    bool running;
+    bool retaining;
+    bool restarting;
+    size_t restart_at;
+    std::vector<Edit> pending;
+    std::vector<Edit> retained;
+    std::vector<Edit> restart_edits;
+    mutable std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+
+    void write_loop();
+    bool rewrite(const std::vector<Edit>& first, const std::vector<Edit>& rest, size_t from);
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "keymap.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <ncurses.h>
+
+// In the order of Action.
+static const char* const ACTION_NAMES[ACTION_COUNT] = {
+    "none", "quit", "insert", "normal", "save",
+    "up", "down", "left", "right",
+    "page-down", "page-up", "half-page-down", "half-page-up", "top", "bottom",
+    "follow", "register", "search", "next-match", "previous-match", "command",
+    "hud", "undo", "redo", "find-file", "open-result",
+    "select-line-up", "select-line-down", "select-left", "select-right",
+    "cut", "copy", "paste", "paste-before", "paste-after",
+    "backspace", "newline", "indent",
+};
+
+struct KeyName {
+    const char* name;
+    int key;
+};
+
+static const KeyName KEY_NAMES[] = {
+    {"Esc", 27}, {"CR", 10}, {"Enter", 10}, {"Tab", 9}, {"S-Tab", KEY_BTAB}, {"BS", 127},
+    {"Space", ' '}, {"lt", '<'}, {"Up", KEY_UP}, {"Down", KEY_DOWN}, {"Left", KEY_LEFT},
+    {"Right", KEY_RIGHT}, {"PageUp", KEY_PPAGE}, {"PageDown", KEY_NPAGE}, {"Home", KEY_HOME},
+    {"End", KEY_END}, {"Del", KEY_DC}, {"Ins", KEY_IC},
+};
+
+struct Binding {
+    char mode;
+    const char* keys;
+    Action action;
+};
+
+static const Binding DEFAULT_BINDINGS[] = {
+    {'n', "q", ACTION_QUIT},
+    {'n', "i", ACTION_INSERT},
+    {'n', "<Esc>", ACTION_NORMAL},
+    {'n', "<C-o>", ACTION_SAVE},
+    {'n', "w", ACTION_UP}, {'n', "W", ACTION_UP}, {'n', "k", ACTION_UP},
+    {'n', "s", ACTION_DOWN}, {'n', "S", ACTION_DOWN}, {'n', "j", ACTION_DOWN},
+    {'n', "a", ACTION_LEFT}, {'n', "A", ACTION_LEFT}, {'n', "h", ACTION_LEFT},
+    {'n', "d", ACTION_RIGHT}, {'n', "D", ACTION_RIGHT}, {'n', "l", ACTION_RIGHT},
+    {'n', "<PageDown>", ACTION_PAGE_DOWN}, {'n', "<C-f>", ACTION_PAGE_DOWN},
+    {'n', "<PageUp>", ACTION_PAGE_UP}, {'n', "<C-b>", ACTION_PAGE_UP},
+    {'n', "<C-d>", ACTION_HALF_PAGE_DOWN},
+    {'n', "<C-u>", ACTION_HALF_PAGE_UP},
+    {'n', "gg", ACTION_TOP},
+    {'n', "G", ACTION_BOTTOM},
+    {'n', "F", ACTION_FOLLOW},
+    {'n', "\"", ACTION_REGISTER},
+    {'n', "/", ACTION_SEARCH},
+    {'n', "n", ACTION_NEXT_MATCH},
+    {'n', "N", ACTION_PREVIOUS_MATCH},
+    {'n', ":", ACTION_COMMAND},
+    {'n', "L", ACTION_HUD},
+    {'n', "u", ACTION_UNDO},
+    {'n', "<C-r>", ACTION_REDO},
+    {'n', "<C-p>", ACTION_FIND_FILE},
+    {'n', "<CR>", ACTION_OPEN_RESULT},
+
+    {'i', "<Esc>", ACTION_NORMAL},
+    {'i', "<Up>", ACTION_UP},
+    {'i', "<Down>", ACTION_DOWN},
+    {'i', "<Left>", ACTION_LEFT},
+    {'i', "<Right>", ACTION_RIGHT},
+    {'i', "<PageDown>", ACTION_PAGE_DOWN},
+    {'i', "<PageUp>", ACTION_PAGE_UP},
+    {'i', "<C-w>", ACTION_SELECT_LINE_UP},
+    {'i', "<C-s>", ACTION_SELECT_LINE_DOWN},
+    {'i', "<C-a>", ACTION_SELECT_LEFT},
+    {'i', "<C-d>", ACTION_SELECT_RIGHT},
+    {'i', "<C-q>", ACTION_CUT},
+    {'i', "<C-k>", ACTION_COPY},
+    {'i', "<C-v>", ACTION_PASTE},
+    {'i', "<C-y>", ACTION_PASTE_BEFORE},
+    {'i', "<C-p>", ACTION_PASTE_AFTER},
+    {'i', "<BS>", ACTION_BACKSPACE},
+    {'i', "<CR>", ACTION_NEWLINE},
+    {'i', "<Tab>", ACTION_INDENT},
+    {'i', "<S-Tab>", ACTION_INDENT},
+};
+
+const char* action_name(Action action){
+    return action < ACTION_COUNT ? ACTION_NAMES[action] : "none";
+}
+
+Action action_named(const std::string& name){
+    for (unsigned i = 1; i < ACTION_COUNT; ++i) {
+        if (name == ACTION_NAMES[i]) {
+            return static_cast<Action>(i);
+        }
+    }
+    return ACTION_NONE;
+}
+
+char mode_named(const std::string& name){
+    if (name == "normal" || name == "n") {
+        return 'n';
+    }
+    if (name == "insert" || name == "i") {
+        return 'i';
+    }
+    return 0;
+}
+
+// Keys a terminal may send for the same thing are folded into one, so a
+// binding for <CR> or <BS> holds whichever the terminal sends.
+int normalize_key(int key){
+    switch (key) {
+        case KEY_ENTER:
+        case '\r':
+            return 10;
+        case KEY_BACKSPACE:
+            return 127;
+        case KEY_CTAB:
+        case KEY_STAB:
+        case KEY_CATAB:
+            return 9;
+        default:
+            return key;
+    }
+}
+
+// Reads a key sequence in the notation of vim's mappings: characters stand
+// for themselves and <...> names a key, e.g. "gg", "<C-s>", "<Esc>", "<M-x>"
+// (escape then x, which is what a terminal sends for alt), "<F5>" or "<lt>".
+bool parse_keys(const std::string& text, std::vector<int>& keys){
+    keys.clear();
+    for (size_t i = 0; i < text.length(); ) {
+        if (text[i] != '<' || text.find('>', i + 1) == std::string::npos) {
+            keys.push_back(static_cast<unsigned char>(text[i++]));
+            continue;
+        }
+        size_t end = text.find('>', i + 1);
+        std::string name = text.substr(i + 1, end - i - 1);
+        i = end + 1;
+        if (name.length() == 3 && (name[0] == 'C' || name[0] == 'c') && name[1] == '-') {
+            char c = static_cast<char>(toupper(static_cast<unsigned char>(name[2])));
+            if (c < '@' || c > '_') {
+                return false;
+            }
+            keys.push_back(c & 0x1f);
+            continue;
+        }
+        if (name.length() == 3 && (name[0] == 'M' || name[0] == 'm' || name[0] == 'A' || name[0] == 'a') && name[1] == '-') {
+            keys.push_back(27);
+            keys.push_back(static_cast<unsigned char>(name[2]));
+            continue;
+        }
+        if (name.length() > 1 && (name[0] == 'F' || name[0] == 'f') && isdigit(static_cast<unsigned char>(name[1]))) {
+            int number = atoi(name.c_str() + 1);
+            if (number < 1 || number > 63) {
+                return false;
+            }
+            keys.push_back(KEY_F(number));
+            continue;
+        }
+        const KeyName* found = std::find_if(std::begin(KEY_NAMES), std::end(KEY_NAMES),
+                                            [&name](const KeyName& key){ return strcasecmp(key.name, name.c_str()) == 0; });
+        if (found == std::end(KEY_NAMES)) {
+            return false;
+        }
+        keys.push_back(found->key);
+    }
+    return !keys.empty();
+}
+
+Keymap::Keymap(){
+    std::vector<int> keys;
+    for (const Binding& binding : DEFAULT_BINDINGS) {
+        parse_keys(binding.keys, keys);
+        bind(binding.mode, keys, binding.action);
+    }
+}
+
+Keymap::Table* Keymap::table(char mode){
+    return mode == 'n' ? &normal : mode == 'i' ? &insert : nullptr;
+}
+
+const Keymap::Table* Keymap::table(char mode) const {
+    return mode == 'n' ? &normal : mode == 'i' ? &insert : nullptr;
+}
+
+bool Keymap::bind(char mode, const std::vector<int>& keys, Action action){
+    Table* bindings = table(mode);
+    if (!bindings || keys.empty() || action == ACTION_NONE) {
+        return false;
+    }
+    (*bindings)[keys] = action;
+    return true;
+}
+
+bool Keymap::unbind(char mode, const std::vector<int>& keys){
+    Table* bindings = table(mode);
+    return bindings && bindings->erase(keys) > 0;
+}
+
+// The table is ordered, so the sequences that start with the given keys
+// follow it directly: the one found at or after it tells both whether it is
+// bound and whether anything longer begins with it.
+unsigned Keymap::lookup(char mode, const int* keys, size_t count, Action& action) const {
+    const Table* bindings = table(mode);
+    if (!bindings) {
+        return 0;
+    }
+    unsigned found = 0;
+    std::vector<int> sequence(keys, keys + count);
+    auto at = bindings->lower_bound(sequence);
+    if (at != bindings->end() && at->first == sequence) {
+        action = at->second;
+        found |= BOUND;
+        ++at;
+    }
+    if (at != bindings->end() && at->first.size() > count && std::equal(keys, keys + count, at->first.begin())) {
+        found |= PREFIX;
+    }
+    return found;
+}
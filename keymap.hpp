@@ -0,0 +1,81 @@
+#ifndef KEYMAP_HPP
+#define KEYMAP_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// What a key can be bound to. Keymap files name them as in action_name().
+enum Action : unsigned char {
+    ACTION_NONE,
+    ACTION_QUIT,
+    ACTION_INSERT,
+    ACTION_NORMAL,
+    ACTION_SAVE,
+    ACTION_UP,
+    ACTION_DOWN,
+    ACTION_LEFT,
+    ACTION_RIGHT,
+    ACTION_PAGE_DOWN,
+    ACTION_PAGE_UP,
+    ACTION_HALF_PAGE_DOWN,
+    ACTION_HALF_PAGE_UP,
+    ACTION_TOP,
+    ACTION_BOTTOM,
+    ACTION_FOLLOW,
+    ACTION_REGISTER,
+    ACTION_SEARCH,
+    ACTION_NEXT_MATCH,
+    ACTION_PREVIOUS_MATCH,
+    ACTION_COMMAND,
+    ACTION_HUD,
+    ACTION_UNDO,
+    ACTION_REDO,
+    ACTION_FIND_FILE,
+    ACTION_OPEN_RESULT,
+    ACTION_SELECT_LINE_UP,
+    ACTION_SELECT_LINE_DOWN,
+    ACTION_SELECT_LEFT,
+    ACTION_SELECT_RIGHT,
+    ACTION_CUT,
+    ACTION_COPY,
+    ACTION_PASTE,
+    ACTION_PASTE_BEFORE,
+    ACTION_PASTE_AFTER,
+    ACTION_BACKSPACE,
+    ACTION_NEWLINE,
+    ACTION_INDENT,
+    ACTION_COUNT
+};
+
+const char* action_name(Action action);
+Action action_named(const std::string& name);
+char mode_named(const std::string& name);
+int normalize_key(int key);
+bool parse_keys(const std::string& text, std::vector<int>& keys);
+
+// The key sequences bound in normal and insert mode. A sequence can be
+// bound and also start a longer one, as "g" would with "gg" bound; lookup
+// reports both so the caller can wait for the next key before deciding.
+class Keymap {
+public:
+    static const unsigned BOUND = 1;
+    static const unsigned PREFIX = 2;
+
+    Keymap();
+
+    bool bind(char mode, const std::vector<int>& keys, Action action);
+    bool unbind(char mode, const std::vector<int>& keys);
+    unsigned lookup(char mode, const int* keys, size_t count, Action& action) const;
+
+private:
+    using Table = std::map<std::vector<int>, Action>;
+
+    Table normal;
+    Table insert;
+
+    Table* table(char mode);
+    const Table* table(char mode) const;
+};
+
+#endif
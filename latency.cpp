@@ -0,0 +1,68 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <cstdio>
+
+static const size_t HISTORY_LIMIT = 1 << 20;
+static const char* PHASE_NAMES[PHASE_COUNT] = {"input_us", "update_us", "print_us", "status_us", "total_us"};
+
+LatencyLog::LatencyLog(size_t window) : window(window), recorded(0), keep_all(false){}
+
+void LatencyLog::record(FrameTiming timing){
+    timing.us[PHASE_TOTAL] = 0;
+    for (int phase = 0; phase < PHASE_TOTAL; ++phase) {
+        timing.us[PHASE_TOTAL] += timing.us[phase];
+    }
+    ++recorded;
+    recent.push_back(timing);
+    if (recent.size() > window) {
+        recent.pop_front();
+    }
+    if (keep_all && history.size() < HISTORY_LIMIT) {
+        history.push_back(timing);
+    }
+}
+
+// Keeping every frame (up to a million) is only needed for dump().
+void LatencyLog::keep(bool all){
+    keep_all = all;
+}
+
+double LatencyLog::percentile(Phase phase, double p) const {
+    if (recent.empty()) return 0;
+    std::vector<double> samples;
+    samples.reserve(recent.size());
+    for (const FrameTiming& timing : recent) {
+        samples.push_back(timing.us[phase]);
+    }
+    size_t index = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+double LatencyLog::max(Phase phase) const {
+    double longest = 0;
+    for (const FrameTiming& timing : recent) {
+        longest = std::max(longest, timing.us[phase]);
+    }
+    return longest;
+}
+
+size_t LatencyLog::frames() const {
+    return recorded;
+}
+
+bool LatencyLog::dump(const std::string& path) const {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) return false;
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        fprintf(out, "%s%s", phase ? "," : "", PHASE_NAMES[phase]);
+    }
+    fputc('\n', out);
+    for (const FrameTiming& timing : history) {
+        for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+            fprintf(out, "%s%.1f", phase ? "," : "", timing.us[phase]);
+        }
+        fputc('\n', out);
+    }
+    return fclose(out) == 0;
+}
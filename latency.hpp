@@ -0,0 +1,33 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+
+enum Phase { PHASE_INPUT, PHASE_UPDATE, PHASE_PRINT, PHASE_STATUS, PHASE_TOTAL, PHASE_COUNT };
+
+struct FrameTiming {
+    double us[PHASE_COUNT] = {};
+};
+
+class LatencyLog {
+public:
+    explicit LatencyLog(size_t window = 256);
+
+    void record(FrameTiming timing);
+    void keep(bool all);
+    double percentile(Phase phase, double p) const;
+    double max(Phase phase) const;
+    size_t frames() const;
+    bool dump(const std::string& path) const;
+
+private:
+    size_t window;
+    size_t recorded;
+    bool keep_all;
+    std::deque<FrameTiming> recent;
+    std::vector<FrameTiming> history;
+};
+
+#endif
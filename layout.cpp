@@ -0,0 +1,248 @@
+#include "layout.hpp"
+#include "utf8.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+static const size_t CACHE_LIMIT = 4096;
+
+// True when none of the eight bytes is a tab or has its top bit set.
+static bool plain_word(const char* bytes){
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    uint64_t tabs = word ^ (ones * '\t');
+    return ((word | ((tabs - ones) & ~tabs)) & highs) == 0;
+}
+
+LineLayout::LineLayout() : length(0){}
+
+LineLayout::LineLayout(std::string_view line, size_t tab_width) : length(line.length()){
+    size_t byte = 0;
+    size_t column = 0;
+    scan(line, byte, column, line.length(), tab_width);
+}
+
+// Adds the stops of the characters from byte up to at least end, leaving
+// byte and column just past the last character read.
+void LineLayout::scan(std::string_view line, size_t& byte, size_t& column, size_t end, size_t tab_width){
+    while (byte < end) {
+        if (byte + 8 <= end && plain_word(line.data() + byte)) {
+            byte += 8;
+            column += 8;
+            continue;
+        }
+        unsigned char c = static_cast<unsigned char>(line[byte]);
+        if (c != '\t' && c < 0x80) {
+            ++byte;
+            ++column;
+            continue;
+        }
+        size_t bytes = 1;
+        size_t width;
+        if (c == '\t') {
+            width = tab_width - column % tab_width;
+        } else {
+            uint32_t code;
+            bytes = utf8_decode(line, byte, code);
+            width = static_cast<size_t>(char_width(code));
+        }
+        stops.push_back({byte, bytes, column, width});
+        byte += bytes;
+        column += width;
+    }
+}
+
+// Brings the layout up to date with a line in which the removed bytes at
+// from were replaced. Only the new bytes are read; the stops after them are
+// moved along, and a tab among them absorbs the change in width unless it
+// crosses a tab stop. An edit that splits a character reads from its start,
+// and one that joins bytes into the next character reads on until the old
+// and new lines agree on where characters begin.
+void LineLayout::patch(std::string_view line, size_t from, size_t removed, size_t tab_width){
+    if (from > length) {
+        *this = LineLayout(line, tab_width);
+        return;
+    }
+    removed = std::min(removed, length - from);
+    auto first = std::upper_bound(stops.begin(), stops.end(), from,
+                                  [](size_t b, const Stop& stop){ return b < stop.byte + stop.length; });
+    if (first != stops.end() && first->byte < from) {
+        removed += from - first->byte;
+        from = first->byte;
+    }
+    // bytes that did not decode may become a character with the new ones
+    for (int back = 0; back < 3 && first != stops.begin(); ++back, --first) {
+        const Stop& before = *(first - 1);
+        if (before.length != 1 || before.byte + 1 != from || line[before.byte] == '\t') {
+            break;
+        }
+        ++removed;
+        from = before.byte;
+    }
+    size_t old_length = length;
+    size_t column = column_in(stops, from);
+    size_t start = column;
+    std::vector<Stop> old(first, stops.end());
+    stops.erase(first, stops.end());
+    length = line.length();
+
+    // where the old line continues unchanged, in new bytes
+    size_t rest = from + removed + length - old_length;
+    size_t byte = from;
+    scan(line, byte, column, rest, tab_width);
+    auto inside = [&](size_t at){
+        auto after = std::upper_bound(old.begin(), old.end(), at,
+                                      [](size_t b, const Stop& stop){ return b < stop.byte; });
+        return after != old.begin() && at < (after - 1)->byte + (after - 1)->length;
+    };
+    while (byte < length && inside(byte + old_length - length)) {
+        scan(line, byte, column, byte + 1, tab_width);
+    }
+
+    // the offsets wrap around for a line that got shorter
+    size_t at = byte + old_length - length;
+    size_t shift = length - old_length;
+    size_t widen = column - (old.empty() || at < old.front().byte ? start + at - from : column_in(old, at));
+    for (const Stop& stop : old) {
+        if (stop.byte < at) {
+            continue;
+        }
+        Stop moved = {stop.byte + shift, stop.length, stop.column + widen, stop.width};
+        if (widen != 0 && line[moved.byte] == '\t') {
+            moved.width = tab_width - moved.column % tab_width;
+            widen += moved.width - stop.width;
+        }
+        stops.push_back(moved);
+    }
+}
+
+size_t LineLayout::column_in(const std::vector<Stop>& stops, size_t byte){
+    auto after = std::upper_bound(stops.begin(), stops.end(), byte,
+                                  [](size_t b, const Stop& stop){ return b < stop.byte; });
+    if (after == stops.begin()) {
+        return byte;
+    }
+    const Stop& stop = *(after - 1);
+    return byte < stop.byte + stop.length ? stop.column : stop.column + stop.width + (byte - stop.byte - stop.length);
+}
+
+size_t LineLayout::column(size_t byte) const {
+    return column_in(stops, byte);
+}
+
+// The first byte of the character whose cells cover the given column, or the
+// end of the line.
+size_t LineLayout::byte_at(size_t column) const {
+    auto after = std::upper_bound(stops.begin(), stops.end(), column,
+                                  [](size_t c, const Stop& stop){ return c < stop.column; });
+    size_t byte = column;
+    if (after != stops.begin()) {
+        const Stop& stop = *(after - 1);
+        byte = column < stop.column + stop.width ? stop.byte : stop.byte + stop.length + (column - stop.column - stop.width);
+    }
+    return std::min(byte, length);
+}
+
+size_t LineLayout::width() const {
+    return column(length);
+}
+
+// The first column of each screen row the line takes when wrapped at the
+// given width. A tab or wide character that would cross the edge starts the
+// next row instead.
+std::vector<size_t> LineLayout::wrap(size_t width) const {
+    std::vector<size_t> starts(1, 0);
+    size_t total = this->width();
+    for (size_t start = 0; total - start > width;) {
+        size_t next = column(byte_at(start + width));
+        start = next > start ? next : start + width;
+        starts.push_back(start);
+    }
+    return starts;
+}
+
+LayoutCache::LayoutCache(size_t tab_width) : tabs(tab_width), wrap_width(0){}
+
+const LineLayout& LayoutCache::get(size_t line, std::string_view text){
+    auto found = layouts.find(line);
+    if (found != layouts.end()) {
+        auto change = changes.find(line);
+        if (change != changes.end()) {
+            found->second.patch(text, change->second.from, change->second.removed, tabs);
+            changes.erase(change);
+        }
+        return found->second;
+    }
+    if (layouts.size() >= CACHE_LIMIT) {
+        layouts.clear();
+        changes.clear();
+    }
+    return layouts.emplace(line, LineLayout(text, tabs)).first->second;
+}
+
+// Wrapped rows are kept per line like layouts and dropped with them, or all
+// at once when the width changes.
+const std::vector<size_t>& LayoutCache::rows(size_t line, std::string_view text, size_t width){
+    if (width != wrap_width) {
+        wraps.clear();
+        wrap_width = width;
+    }
+    auto found = wraps.find(line);
+    if (found != wraps.end()) {
+        return found->second;
+    }
+    std::vector<size_t> starts = get(line, text).wrap(width);
+    if (wraps.size() >= CACHE_LIMIT) {
+        wraps.clear();
+    }
+    return wraps.emplace(line, std::move(starts)).first->second;
+}
+
+template <typename Map>
+static void erase_lines(Map& map, size_t first, size_t last){
+    for (auto it = map.begin(); it != map.end();) {
+        if (it->first >= first && it->first <= last) {
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Notes that bytes of a line were replaced starting at from, where removed
+// may run past the end of the line. The layout is patched when next asked
+// for, as the line has not been changed yet; a second change before then
+// drops it instead.
+void LayoutCache::edited(size_t line, size_t from, size_t removed){
+    wraps.erase(line);
+    if (layouts.count(line) == 0) {
+        return;
+    }
+    if (!changes.emplace(line, Change{from, removed}).second) {
+        layouts.erase(line);
+        changes.erase(line);
+    }
+}
+
+void LayoutCache::invalidate(size_t first, size_t last){
+    erase_lines(layouts, first, last);
+    erase_lines(wraps, first, last);
+    erase_lines(changes, first, last);
+}
+
+void LayoutCache::clear(){
+    layouts.clear();
+    wraps.clear();
+    changes.clear();
+}
+
+void LayoutCache::set_tab_width(size_t width){
+    tabs = std::max<size_t>(width, 1);
+    clear();
+}
+
+size_t LayoutCache::tab_width() const {
+    return tabs;
+}
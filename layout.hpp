@@ -0,0 +1,60 @@
+#ifndef LAYOUT_HPP
+#define LAYOUT_HPP
+
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+// Maps byte offsets in one line to display columns. Only tabs and multibyte
+// characters are stored, so a plain ASCII line costs nothing and a lookup is
+// a binary search over the stored stops.
+class LineLayout {
+public:
+    LineLayout();
+    LineLayout(std::string_view line, size_t tab_width);
+
+    void patch(std::string_view line, size_t from, size_t removed, size_t tab_width);
+    size_t column(size_t byte) const;
+    size_t byte_at(size_t column) const;
+    size_t width() const;
+    std::vector<size_t> wrap(size_t width) const;
+
+private:
+    struct Stop {
+        size_t byte;
+        size_t length;
+        size_t column;
+        size_t width;
+    };
+    std::vector<Stop> stops;
+    size_t length;
+
+    static size_t column_in(const std::vector<Stop>& stops, size_t byte);
+    void scan(std::string_view line, size_t& byte, size_t& column, size_t end, size_t tab_width);
+};
+
+class LayoutCache {
+public:
+    explicit LayoutCache(size_t tab_width = 4);
+
+    const LineLayout& get(size_t line, std::string_view text);
+    const std::vector<size_t>& rows(size_t line, std::string_view text, size_t width);
+    void edited(size_t line, size_t from, size_t removed);
+    void invalidate(size_t first, size_t last);
+    void clear();
+    void set_tab_width(size_t width);
+    size_t tab_width() const;
+
+private:
+    struct Change {
+        size_t from;
+        size_t removed;
+    };
+    size_t tabs;
+    size_t wrap_width;
+    std::unordered_map<size_t, LineLayout> layouts;
+    std::unordered_map<size_t, std::vector<size_t>> wraps;
+    std::unordered_map<size_t, Change> changes;
+};
+
+#endif
@@ -2,12 +2,8 @@
 #include <memory>
 
 int main( int argc, char **argv ){
-	if (argc > 1){
-		auto shard = std::make_shared<Shard>(argv[1]);
-	 	shard->run();	
-	}else{
-		auto shard = std::make_shared<Shard>("");
-			 	shard->run();	
-	};
+	std::vector<std::string> files(argv + 1, argv + argc);
+	auto shard = std::make_shared<Shard>(files);
+	shard->run();
 	return 0;
 };
@@ -0,0 +1,118 @@
+#include "replace.hpp"
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+
+static const size_t BLOCK_LINES = 4096;
+
+// Without the global flag only the first match in the line is replaced.
+static void substitute_line(std::string_view line, size_t row, const std::regex& pattern,
+                            const std::string& format, bool global, Substitution& block){
+    const char* begin = line.data();
+    const char* end = begin + line.length();
+    std::cregex_iterator match(begin, end, pattern), stop;
+    if (match == stop) {
+        block.text.append(begin, end);
+        return;
+    }
+
+    size_t line_start = block.text.length();
+    size_t first_col = static_cast<size_t>(match->position(0));
+    const char* copied = begin;
+    for (; match != stop; ++match) {
+        block.text.append(copied, (*match)[0].first);
+        match->format(std::back_inserter(block.text), format);
+        copied = (*match)[0].second;
+        ++block.replaced;
+        if (!global) {
+            break;
+        }
+    }
+    block.text.append(copied, end);
+
+    size_t tail = static_cast<size_t>(end - copied);
+    size_t new_length = block.text.length() - line_start;
+    Edit edit;
+    edit.y = row;
+    edit.x = first_col;
+    edit.removed.assign(begin + first_col, copied);
+    edit.inserted = block.text.substr(line_start + first_col, new_length - tail - first_col);
+    block.edits.push_back(std::move(edit));
+}
+
+// Rewrites lines [first, first + count) into block.text; the block is only
+// kept when at least one line in it changed.
+static void substitute_block(const TextBuffer& lines, const std::regex& pattern,
+                             const std::string& format, bool global, Substitution& block){
+    size_t last = block.first + block.count;
+    lines.each_span(block.first, [&](size_t row, std::string_view text){
+        const char* cursor = text.data();
+        const char* end = cursor + text.length();
+        while (row < last) {
+            const char* line_break = static_cast<const char*>(memchr(cursor, '\n', static_cast<size_t>(end - cursor)));
+            const char* line_end = line_break ? line_break : end;
+            if (row > block.first) {
+                block.text += '\n';
+            }
+            substitute_line(std::string_view(cursor, static_cast<size_t>(line_end - cursor)), row, pattern, format, global, block);
+            ++row;
+            if (!line_break) {
+                return row >= last;
+            }
+            cursor = line_break + 1;
+        }
+        return true;
+    });
+    if (block.edits.empty()) {
+        block.text.clear();
+        block.text.shrink_to_fit();
+    }
+}
+
+// Matches lines [first, first + count) of the buffer on a pool of threads
+// that take blocks of lines from a shared counter. The buffer is only read
+// here; the caller applies the returned blocks, which come back in line order.
+std::vector<Substitution> substitute(const TextBuffer& lines, size_t first, size_t count, const std::regex& pattern,
+                                     const std::string& format, bool global, unsigned threads){
+    std::vector<Substitution> blocks((count + BLOCK_LINES - 1) / BLOCK_LINES);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        blocks[i].first = first + i * BLOCK_LINES;
+        blocks[i].count = std::min(BLOCK_LINES, first + count - blocks[i].first);
+    }
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr failure;
+    std::atomic<bool> failed(false);
+    auto work = [&](){
+        for (size_t i = next++; i < blocks.size() && !failed; i = next++) {
+            try {
+                substitute_block(lines, pattern, format, global, blocks[i]);
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    failure = std::current_exception();
+                }
+            }
+        }
+    };
+
+    size_t used = std::min<size_t>(std::max(threads, 1u), blocks.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < used; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+
+    blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                                [](const Substitution& block){ return block.edits.empty(); }),
+                 blocks.end());
+    return blocks;
+}
@@ -0,0 +1,21 @@
+#ifndef REPLACE_HPP
+#define REPLACE_HPP
+
+#include <string>
+#include <vector>
+#include <regex>
+#include "buffer.hpp"
+#include "history.hpp"
+
+struct Substitution {
+    size_t first = 0;
+    size_t count = 0;
+    size_t replaced = 0;
+    std::string text;
+    std::vector<Edit> edits;
+};
+
+std::vector<Substitution> substitute(const TextBuffer& lines, size_t first, size_t count, const std::regex& pattern,
+                                     const std::string& format, bool global, unsigned threads);
+
+#endif
@@ -0,0 +1,177 @@
+#include "shard.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static std::atomic<size_t> allocations(0);
+
+// Every allocation in the process goes through here, so each replayed key can
+// report how many it caused.
+__attribute__((noinline)) void* operator new(size_t size){
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+struct Corpus {
+    std::string name;
+    std::string path;
+    size_t lines;
+    size_t words;
+    int tab_every;
+};
+
+struct Script {
+    std::string name;
+    std::string keys;
+};
+
+static std::string repeat(const std::string& text, size_t count){
+    std::string out;
+    for (size_t i = 0; i < count; ++i) {
+        out += text;
+    }
+    return out;
+}
+
+static void generate(const Corpus& corpus){
+    struct stat st;
+    if (stat(corpus.path.c_str(), &st) == 0) {
+        return;
+    }
+    static const char* words[] = {"request", "latency", "buffer", "shard", "error", "warning",
+                                  "connection", "timeout", "user", "session", "GET", "POST", "200", "404"};
+    std::mt19937 rng(7);
+    std::ofstream out(corpus.path);
+    std::string line;
+    for (size_t i = 0; i < corpus.lines; ++i) {
+        line.clear();
+        size_t count = corpus.words / 2 + rng() % corpus.words;
+        for (size_t w = 0; w < count; ++w) {
+            line += words[rng() % (sizeof(words) / sizeof(words[0]))];
+            line += (corpus.tab_every && rng() % corpus.tab_every == 0) ? '\t' : ' ';
+        }
+        line += '\n';
+        out << line;
+    }
+}
+
+// Scripts are plain keys with <Name> for the rest: <Esc>, <Enter>, <BS>,
+// <Tab>, <Up>, <Down>, <Left>, <Right>, <PgUp>, <PgDn> and <C-x>. Line
+// breaks in a script file are ignored.
+static std::vector<int> parse_keys(const std::string& script){
+    std::vector<int> keys;
+    for (size_t i = 0; i < script.length(); ++i) {
+        size_t close = script[i] == '<' ? script.find('>', i) : std::string::npos;
+        if (close == std::string::npos) {
+            if (script[i] != '\n') {
+                keys.push_back(static_cast<unsigned char>(script[i]));
+            }
+            continue;
+        }
+        std::string name = script.substr(i + 1, close - i - 1);
+        i = close;
+        if (name == "Esc") keys.push_back(27);
+        else if (name == "Enter") keys.push_back(10);
+        else if (name == "BS") keys.push_back(127);
+        else if (name == "Tab") keys.push_back(9);
+        else if (name == "Up") keys.push_back(KEY_UP);
+        else if (name == "Down") keys.push_back(KEY_DOWN);
+        else if (name == "Left") keys.push_back(KEY_LEFT);
+        else if (name == "Right") keys.push_back(KEY_RIGHT);
+        else if (name == "PgUp") keys.push_back(KEY_PPAGE);
+        else if (name == "PgDn") keys.push_back(KEY_NPAGE);
+        else if (name.length() == 3 && name.compare(0, 2, "C-") == 0) keys.push_back(name[2] & 31);
+        else fprintf(stderr, "replay: unknown key <%s>\n", name.c_str());
+    }
+    return keys;
+}
+
+static double percentile(std::vector<double> samples, double p){
+    if (samples.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+// Runs one frame per key against a virtual screen, so each sample is the
+// key's handling plus the redraw of the previous frame, with no TTY involved.
+static void replay(const Corpus& corpus, const Script& script){
+    std::vector<int> keys = parse_keys(script.keys);
+    auto screen = std::make_unique<VirtualTerminal>(24, 80);
+    VirtualTerminal* term = screen.get();
+    Shard shard(corpus.path, std::move(screen));
+    shard.frame();
+
+    std::vector<double> latency;
+    size_t allocated = allocations.load();
+    size_t emitted = term->emitted();
+    for (int key : keys) {
+        if (!shard.running()) break;
+        term->feed(key);
+        auto begin = std::chrono::steady_clock::now();
+        shard.frame();
+        latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+    size_t count = std::max<size_t>(latency.size(), 1);
+    printf("%-10s %-8s %6zu %10.1f %10.1f %10.1f %10.1f %10.1f\n", corpus.name.c_str(), script.name.c_str(), latency.size(),
+           percentile(latency, 0.5), percentile(latency, 0.99), latency.empty() ? 0 : *std::max_element(latency.begin(), latency.end()),
+           static_cast<double>(allocations.load() - allocated) / count, static_cast<double>(term->emitted() - emitted) / count);
+}
+
+int main(int argc, char** argv){
+    std::vector<Corpus> corpora = {
+        {"1K", "/tmp/shard-replay-1k.txt", 1000, 10, 0},
+        {"100K", "/tmp/shard-replay-100k.txt", 100000, 10, 0},
+        {"1M", "/tmp/shard-replay-1m.txt", 1000000, 10, 0},
+        {"10M", "/tmp/shard-replay-10m.txt", 10000000, 6, 0},
+        {"long", "/tmp/shard-replay-long.txt", 2000, 2000, 0},
+        {"tabs", "/tmp/shard-replay-tabs.txt", 100000, 10, 2},
+    };
+
+    std::vector<Script> scripts;
+    for (int i = 1; i < argc; ++i) {
+        std::ifstream in(argv[i]);
+        std::stringstream text;
+        text << in.rdbuf();
+        scripts.push_back({argv[i], text.str()});
+    }
+    if (scripts.empty()) {
+        scripts = {
+            {"scroll", repeat("j", 100) + repeat("<C-f>", 50) + repeat("<C-b>", 50) + "G" + repeat("k", 100) + "gg"},
+            {"type", "i" + repeat("the quick brown fox<Enter>", 20) + repeat("<BS>", 40) + "<Esc>"},
+            {"search", "/session<Enter>" + repeat("n", 50) + repeat("N", 50) + "<Esc>"},
+            {"edit", "i" + repeat("x<Right>", 60) + repeat("<Down><Tab>", 40) + "<Esc>" + repeat("u", 20) + repeat("<C-r>", 20)},
+            {"wrap", ":set wrap<Enter>" + repeat("j", 100) + repeat("<C-f>", 50) + repeat("<C-b>", 50) + "G" + repeat("k", 100) + "gg"},
+            {"syntax", ":set syntax=c<Enter>i/*<Esc>" + repeat("<C-f>", 20) + "i" + repeat("int x = 1; // y<Enter>", 20) + "<Esc>" + repeat("u", 20) + "G" + repeat("k", 50)},
+        };
+    }
+
+    printf("%-10s %-8s %6s %10s %10s %10s %10s %10s\n", "file", "script", "keys", "p50 us", "p99 us", "max us", "allocs/key", "bytes/key");
+    for (const Corpus& corpus : corpora) {
+        generate(corpus);
+        for (const Script& script : scripts) {
+            replay(corpus, script);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "save.hpp"
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const size_t WRITE_BATCH = 8 << 20;
+static const size_t IOV_BATCH = 1024;
+static const char NEWLINE = '\n';
+
+SaveJob::SaveJob(Snapshot snapshot, std::string path, std::shared_ptr<MappedFile> file)
+    : snapshot(std::move(snapshot)), path(std::move(path)), file(std::move(file)), bytes(0), copy_bytes(0),
+      copy_length(0), finished(false){}
+
+SaveJob::~SaveJob(){
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void SaveJob::run(){
+    started = std::chrono::steady_clock::now();
+    save();
+    ended = std::chrono::steady_clock::now();
+    finished.store(true, std::memory_order_release);
+}
+
+void SaveJob::start(){
+    worker = std::thread([this]{ run(); });
+}
+
+bool SaveJob::done() const {
+    return finished.load(std::memory_order_acquire);
+}
+
+bool SaveJob::ok() const {
+    return done() && failure.empty();
+}
+
+const std::string& SaveJob::error() const {
+    return failure;
+}
+
+size_t SaveJob::written() const {
+    return bytes.load(std::memory_order_relaxed);
+}
+
+size_t SaveJob::total() const {
+    return snapshot.bytes;
+}
+
+// Bytes of the buffer's file copied out so far before an in-place write,
+// and how many there are; both stay 0 when the file is replaced instead.
+size_t SaveJob::copied() const {
+    return copy_bytes.load(std::memory_order_relaxed);
+}
+
+size_t SaveJob::copy_total() const {
+    return copy_length.load(std::memory_order_relaxed);
+}
+
+double SaveJob::seconds() const {
+    auto end = done() ? ended : std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - started).count();
+}
+
+// Gathers the spans into batches of up to WRITE_BATCH bytes and hands each
+// batch to writev, so lines are never copied and a large span of a mapped
+// file goes out in a few calls.
+bool SaveJob::write_all(int fd){
+    std::vector<iovec> iov;
+    size_t pending = 0;
+    auto flush = [&]{
+        size_t index = 0;
+        while (index < iov.size()) {
+            int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+            ssize_t n = writev(fd, iov.data() + index, count);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            bytes.fetch_add(static_cast<size_t>(n), std::memory_order_relaxed);
+            size_t left = static_cast<size_t>(n);
+            while (index < iov.size() && left >= iov[index].iov_len) {
+                left -= iov[index].iov_len;
+                ++index;
+            }
+            if (left > 0) {
+                iov[index].iov_base = static_cast<char*>(iov[index].iov_base) + left;
+                iov[index].iov_len -= left;
+            }
+        }
+        iov.clear();
+        pending = 0;
+        return true;
+    };
+    auto add = [&](const char* data, size_t length){
+        iov.push_back({const_cast<char*>(data), length});
+        pending += length;
+        return (iov.size() < IOV_BATCH && pending < WRITE_BATCH) || flush();
+    };
+
+    for (size_t i = 0; i < snapshot.spans.size(); ++i) {
+        if (i > 0 && !add(&NEWLINE, 1)) {
+            return false;
+        }
+        std::string_view span = snapshot.spans[i];
+        while (!span.empty()) {
+            size_t take = std::min(span.length(), WRITE_BATCH - pending);
+            if (!add(span.data(), take)) {
+                return false;
+            }
+            span.remove_prefix(take);
+        }
+    }
+    return flush();
+}
+
+// The file a path names, through any symlinks; a new file is its own.
+static std::string resolve(const std::string& path){
+    char* resolved = realpath(path.c_str(), nullptr);
+    std::string target = resolved ? resolved : path;
+    free(resolved);
+    return target;
+}
+
+// New files get the permissions open() would give them. The mask is read
+// from /proc rather than set and put back with umask(), which would race
+// with files created on other threads.
+static mode_t creation_mode(){
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "Umask:") == 0) {
+            return 0666 & ~static_cast<mode_t>(strtoul(line.c_str() + 6, nullptr, 8));
+        }
+    }
+    return 0644;
+}
+
+// The file is replaced in one rename only after the new contents are on
+// disk, so a crash at any point leaves either the old or the new file. The
+// rename goes over the file a symlink points to, and the new file gets the
+// old one's owner and mode, as far as the user may set them. Renaming a new
+// file over one with other hard links would split it from them, so such a
+// file is rewritten where it is instead.
+bool SaveJob::save(){
+    std::string target = resolve(path);
+    struct stat st;
+    bool existing = stat(target.c_str(), &st) == 0;
+    if (existing && S_ISREG(st.st_mode) && st.st_nlink > 1) {
+        return save_in_place(target, st);
+    }
+
+    size_t slash = target.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : target.substr(0, slash));
+    std::string name = slash == std::string::npos ? target : target.substr(slash + 1);
+    std::string temp = dir + "/." + name + ".shard-XXXXXX";
+    int fd = mkostemp(&temp[0], O_CLOEXEC);
+    if (fd < 0) {
+        failure = "Permission denied! File: " + path;
+        return false;
+    }
+    if (existing) {
+        if (fchown(fd, st.st_uid, st.st_gid) != 0) {
+            // not ours to give away; keep the group if we may
+            (void)fchown(fd, static_cast<uid_t>(-1), st.st_gid);
+        }
+        fchmod(fd, st.st_mode & 07777);
+    } else {
+        fchmod(fd, creation_mode());
+    }
+    bool written = write_all(fd) && fsync(fd) == 0;
+    written = ::close(fd) == 0 && written;
+    if (!written || rename(temp.c_str(), target.c_str()) != 0) {
+        unlink(temp.c_str());
+        failure = "Could not write file: " + path;
+        return false;
+    }
+
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    return true;
+}
+
+// Writes over the old contents and cuts the file to the new length. This
+// is not atomic; a crash part way leaves the journal to recover from. When
+// the buffer still reads the file through its mapping, the mapping is first
+// copied out here rather than on the UI thread, so neither the snapshot nor
+// the buffer reads what is being overwritten.
+bool SaveJob::save_in_place(const std::string& target, const struct stat& st){
+    if (file && file->same_file(st)) {
+        copy_length.store(file->size(), std::memory_order_relaxed);
+        if (!file->detach(&copy_bytes)) {
+            failure = "Could not copy " + path + " to write it in place";
+            return false;
+        }
+    }
+    int fd = ::open(target.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        failure = "Permission denied! File: " + path;
+        return false;
+    }
+    bool written = write_all(fd) && ftruncate(fd, static_cast<off_t>(bytes.load())) == 0 && fsync(fd) == 0;
+    written = ::close(fd) == 0 && written;
+    if (!written) {
+        failure = "Could not write file: " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef SAVE_HPP
+#define SAVE_HPP
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include "buffer.hpp"
+
+class SaveJob {
+public:
+    SaveJob(Snapshot snapshot, std::string path, std::shared_ptr<MappedFile> file = nullptr);
+    ~SaveJob();
+    SaveJob(const SaveJob&) = delete;
+    SaveJob& operator=(const SaveJob&) = delete;
+
+    void run();
+    void start();
+    bool done() const;
+    bool ok() const;
+    const std::string& error() const;
+    size_t written() const;
+    size_t total() const;
+    size_t copied() const;
+    size_t copy_total() const;
+    double seconds() const;
+
+private:
+    Snapshot snapshot;
+    std::string path;
+    std::shared_ptr<MappedFile> file;
+    std::string failure;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> copy_bytes;
+    std::atomic<size_t> copy_length;
+    std::atomic<bool> finished;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point ended;
+    std::thread worker;
+
+    bool write_all(int fd);
+    bool save();
+    bool save_in_place(const std::string& target, const struct stat& st);
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "search.hpp"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+const char* find_text_scalar(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    if (m == 0) return begin;
+    while (static_cast<size_t>(end - begin) >= m) {
+        const void* hit = memchr(begin, needle[0], static_cast<size_t>(end - begin) - m + 1);
+        if (!hit) return nullptr;
+        const char* candidate = static_cast<const char*>(hit);
+        if (memcmp(candidate + 1, needle.data() + 1, m - 1) == 0) return candidate;
+        begin = candidate + 1;
+    }
+    return nullptr;
+}
+
+// The last match in [begin, end), for searching backwards: the range is
+// walked from its end so the cost is the distance to the match.
+const char* find_text_last_scalar(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    if (m == 0) return end;
+    while (static_cast<size_t>(end - begin) >= m) {
+        const void* hit = memrchr(begin, needle[0], static_cast<size_t>(end - begin) - m + 1);
+        if (!hit) return nullptr;
+        const char* candidate = static_cast<const char*>(hit);
+        if (memcmp(candidate + 1, needle.data() + 1, m - 1) == 0) return candidate;
+        end = candidate + m - 1;
+    }
+    return nullptr;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Both vector paths compare the first and the last byte of the needle
+// against a whole block of candidate positions at once and only verify the
+// positions where both agree.
+__attribute__((target("sse2")))
+const char* find_text_sse2(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    size_t n = static_cast<size_t>(end - begin);
+    if (m < 2 || n < m) return find_text_scalar(begin, end, needle);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (memcmp(begin + i + bit + 1, needle.data() + 1, m - 2) == 0) return begin + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_text_scalar(begin + i, end, needle);
+}
+
+__attribute__((target("avx2")))
+const char* find_text_avx2(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    size_t n = static_cast<size_t>(end - begin);
+    if (m < 2 || n < m) return find_text_scalar(begin, end, needle);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (memcmp(begin + i + bit + 1, needle.data() + 1, m - 2) == 0) return begin + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_text_sse2(begin + i, end, needle);
+}
+
+// The same first and last byte test run from the end of the range, taking
+// the highest candidate of each block first.
+__attribute__((target("sse2")))
+const char* find_text_last_sse2(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    size_t n = static_cast<size_t>(end - begin);
+    if (m < 2 || n < m) return find_text_last_scalar(begin, end, needle);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = n - m + 1;
+    for (; i >= 16; i -= 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i - 16));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + i - 16 + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = 31 - static_cast<unsigned>(__builtin_clz(mask));
+            const char* candidate = begin + i - 16 + bit;
+            if (memcmp(candidate + 1, needle.data() + 1, m - 2) == 0) return candidate;
+            mask &= ~(1u << bit);
+        }
+    }
+    return find_text_last_scalar(begin, begin + i + m - 1, needle);
+}
+
+__attribute__((target("avx2")))
+const char* find_text_last_avx2(const char* begin, const char* end, std::string_view needle){
+    size_t m = needle.length();
+    size_t n = static_cast<size_t>(end - begin);
+    if (m < 2 || n < m) return find_text_last_scalar(begin, end, needle);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = n - m + 1;
+    for (; i >= 32; i -= 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i - 32));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i - 32 + m - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+        while (mask) {
+            unsigned bit = 31 - static_cast<unsigned>(__builtin_clz(mask));
+            const char* candidate = begin + i - 32 + bit;
+            if (memcmp(candidate + 1, needle.data() + 1, m - 2) == 0) return candidate;
+            mask &= ~(1u << bit);
+        }
+    }
+    return find_text_last_sse2(begin, begin + i + m - 1, needle);
+}
+
+#endif
+
+using Finder = const char* (*)(const char*, const char*, std::string_view);
+
+static Finder pick_finder(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return find_text_avx2;
+    if (__builtin_cpu_supports("sse2")) return find_text_sse2;
+#endif
+    return find_text_scalar;
+}
+
+static const Finder finder = pick_finder();
+
+static Finder pick_last_finder(){
+#if defined(__x86_64__) || defined(__i386__)
+    if (finder == find_text_avx2) return find_text_last_avx2;
+    if (finder == find_text_sse2) return find_text_last_sse2;
+#endif
+    return find_text_last_scalar;
+}
+
+static const Finder last_finder = pick_last_finder();
+
+const char* find_text(const char* begin, const char* end, std::string_view needle){
+    return finder(begin, end, needle);
+}
+
+const char* find_text_last(const char* begin, const char* end, std::string_view needle){
+    return last_finder(begin, end, needle);
+}
+
+const char* find_text_backend(){
+#if defined(__x86_64__) || defined(__i386__)
+    if (finder == find_text_avx2) return "avx2";
+    if (finder == find_text_sse2) return "sse2";
+#endif
+    return "scalar";
+}
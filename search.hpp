@@ -0,0 +1,20 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <string_view>
+
+const char* find_text(const char* begin, const char* end, std::string_view needle);
+const char* find_text_scalar(const char* begin, const char* end, std::string_view needle);
+#if defined(__x86_64__) || defined(__i386__)
+const char* find_text_sse2(const char* begin, const char* end, std::string_view needle);
+const char* find_text_avx2(const char* begin, const char* end, std::string_view needle);
+#endif
+const char* find_text_last(const char* begin, const char* end, std::string_view needle);
+const char* find_text_last_scalar(const char* begin, const char* end, std::string_view needle);
+#if defined(__x86_64__) || defined(__i386__)
+const char* find_text_last_sse2(const char* begin, const char* end, std::string_view needle);
+const char* find_text_last_avx2(const char* begin, const char* end, std::string_view needle);
+#endif
+const char* find_text_backend();
+
+#endif
@@ -1,820 +1,2890 @@
 #include "shard.hpp"
-#include "clocale"
-#include <fstream>
+#include "search.hpp"
+#include "replace.hpp"
+#include "utf8.hpp"
 #include <sys/stat.h>
-#include <ncurses.h>
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
-#include <csignal>
-#include <termios.h>
-#include <unistd.h>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+
+static const int TYPEAHEAD_LIMIT = 4096;
+static const size_t REBUILD_LINES = 4096;
+static const size_t REBUILD_EDITS = 64;
+static const int HUD_ROWS = 7;
+static const int HUD_COLS = 56;
+static const size_t YANK_RING = 10;
+static const unsigned JOURNAL_INTERVAL = 1000;
+static const int FOLLOW_POLL_MS = 50;
+static const size_t FOLLOW_CHUNK = 16 << 20;
+static const unsigned GREP_MIN_THREADS = 4;
+static const size_t FINDER_QUERY = 256;
+static const int HUD_USAGE_MS = 500;
+static const int ESCAPE_TIMEOUT = 25;
+static const int KEY_TIMEOUT = 1000;
 
 void Shard::paste_at_cursor() {
-    if (clipboard.empty() || y >= lines.size()) {
+    std::shared_ptr<const Clip> clip = paste_source();
+    if (!clip || clip->empty() || buf->y >= buf->lines.size()) {
         status = " CLIPBOARD EMPTY ";
         color_pair = 5;
         return;
     }
 
-    if (select_coords.start.y != -1) {
+    if (buf->select_coords.start.y != -1) {
         delete_selected_text();
         clear_selection();
-        selecting = false;
+        buf->selecting = false;
     }
 
-    size_t prev_x = x;
-    std::string current_line = clipboard;
-    std::string next_line_part = lines[y].substr(x);
-    size_t pos = 0;
-    
-    while ((pos = current_line.find('\n')) != std::string::npos) {
-        std::string part = current_line.substr(0, pos);
-        lines[y].insert(x, part);
-        x += part.length();
-
-        m_insert(lines[y].substr(x) + next_line_part, static_cast<int>(y + 1));
-        lines[y].erase(x);
-        
-        y++;
-        x = 0;
-        next_line_part = ""; 
-        current_line.erase(0, pos + 1);
+    record(buf->y, buf->x, nullptr, clip);
+    insert_clip(buf->y, buf->x, *clip);
+    size_t end_row, end_col;
+    clip->end(buf->y, buf->x, end_row, end_col);
+    buf->x = end_col;
+    if (end_row != buf->y) {
+        goto_line(end_row);
     }
-    
-    lines[y].insert(x, current_line);
-    x += current_line.length();
 
-    status = " PASTED: " + std::to_string(clipboard.length()) + " chars ";
+    status = " PASTED: " + std::to_string(clip->length()) + " chars ";
     color_pair = 4;
 }
 
-void Shard::paste_before_line() {
-    if (clipboard.empty() || lines.empty()) {
-        status = " CLIPBOARD EMPTY ";
-        color_pair = 5;
-        return;
+void Shard::paste_bracketed() {
+    std::string text;
+    bool after_return = false;
+    for (int c = term->read_key(500); c != ERR && c != KEY_PASTE_END; c = term->read_key(500)) {
+        // CRLF line ends become one newline, as does a lone CR
+        if (c == '\n' && after_return) {
+            after_return = false;
+            continue;
+        }
+        after_return = c == '\r';
+        if (c == '\r') {
+            c = '\n';
+        }
+        if (c < 256) {
+            text += static_cast<char>(c);
+        }
     }
 
-    clear_selection();
-    selecting = false;
-    
-    size_t paste_row = y;
-    
-    if (paste_row == 0 && lines[0].empty()) {
-        paste_at_cursor();
-        return;
+    if (buf->select_coords.start.y != -1) {
+        delete_selected_text();
+        clear_selection();
+        buf->selecting = false;
     }
+    insert_text(text);
 
-    x = 0;
-    
-    std::string buffer = clipboard;
-    std::string line;
-    size_t pos = 0;
-    
-    while ((pos = buffer.find('\n')) != std::string::npos) {
-        line = buffer.substr(0, pos);
-        m_insert(line, static_cast<int>(paste_row));
-        paste_row++;
-        buffer.erase(0, pos + 1);
+    status = " PASTED: " + std::to_string(text.length()) + " chars ";
+    color_pair = 4;
+}
+
+// Inserts text at the cursor in one pass: the first line is spliced into the
+// cursor line and every following line goes into the buffer as one block.
+void Shard::insert_text(const std::string& text) {
+    if (buf->y >= buf->lines.size()) {
+        return;
     }
-    
-    if (!buffer.empty()) {
-        m_insert(buffer, static_cast<int>(paste_row));
-        paste_row++;
+    record(buf->y, buf->x, "", text);
+    insert_at(buf->y, buf->x, text);
+
+    size_t last_break = text.rfind('\n');
+    if (last_break == std::string::npos) {
+        buf->x += text.length();
+        return;
     }
+    buf->y += static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+    buf->x = text.length() - last_break - 1;
+    goto_line(buf->y);
+}
 
-    y = paste_row - (clipboard.find('\n') == std::string::npos ? 1 : 0);
-    x = 0; 
+void Shard::insert_at(size_t row, size_t col, const std::string& text) {
+    size_t first_break = text.find('\n');
+    if (first_break == std::string::npos) {
+        m_edit(row, col, 0).insert(col, text);
+        return;
+    }
 
-    status = " PASTED (BEFORE): " + std::to_string(clipboard.length()) + " chars ";
-    color_pair = 4;
+    std::string block = text.substr(first_break + 1);
+    block += buf->lines[row].substr(col);
+    m_edit(row, col, SIZE_MAX).replace(col, std::string::npos, text, 0, first_break);
+    mark_from(row + 1);
+    insert_lines(row + 1, std::move(block));
 }
 
-void Shard::paste_after_line() {
-    if (clipboard.empty() || lines.empty()) {
-        status = " CLIPBOARD EMPTY ";
-        color_pair = 5;
+void Shard::erase_range(size_t row, size_t col, size_t end_row, size_t end_col) {
+    if (row == end_row) {
+        m_edit(row, col, end_col - col).erase(col, end_col - col);
         return;
     }
 
-    clear_selection();
-    selecting = false;
-    
-    size_t paste_row = y + 1;
-    
-    x = 0;
-    
-    std::string buffer = clipboard;
-    std::string line;
-    size_t pos = 0;
-    
-    while ((pos = buffer.find('\n')) != std::string::npos) {
-        line = buffer.substr(0, pos);
-        m_insert(line, static_cast<int>(paste_row));
-        paste_row++;
-        buffer.erase(0, pos + 1);
-    }
-    
-    if (!buffer.empty()) {
-        m_insert(buffer, static_cast<int>(paste_row));
-        paste_row++;
-    }
+    std::string rest(buf->lines[end_row].substr(end_col));
+    m_edit(row, col, SIZE_MAX).replace(col, std::string::npos, rest);
+    mark_from(row + 1);
+    erase_lines(row + 1, end_row - row);
+}
 
-    y = y + 1;	
-    x = 0; 
+void Shard::record(size_t row, size_t col, std::string removed, std::string inserted) {
+    Edit edit;
+    edit.y = row;
+    edit.x = col;
+    edit.removed = std::move(removed);
+    edit.inserted = std::move(inserted);
+    journal_edit(edit, true);
+    buf->history.record(std::move(edit));
+}
 
-    status = " PASTED (AFTER): " + std::to_string(clipboard.length()) + " chars ";
-    color_pair = 4;
+void Shard::record(size_t row, size_t col, std::shared_ptr<const Clip> removed, std::shared_ptr<const Clip> inserted) {
+    Edit edit;
+    edit.y = row;
+    edit.x = col;
+    edit.removed_clip = std::move(removed);
+    edit.inserted_clip = std::move(inserted);
+    journal_edit(edit, true);
+    buf->history.record(std::move(edit));
 }
 
-void Shard::open() {
-    struct stat buffer;
-    if (stat(filename.c_str(), &buffer) == 0){
-        std::ifstream ifile(filename);
-        if (ifile.is_open()){
-            std::string buffer_line;
-            bool empty_file = true;
-            while(std::getline(ifile, buffer_line)){
-                m_append(buffer_line);
-                empty_file = false;
-            }
-            if (empty_file){
-                lines.push_back("");
-            }
-            ifile.close();
-        } else {
-            throw std::runtime_error("Could not open file. Permission denied! File: " + filename);
-        }
-    } else {
-        std::string str {};
-        m_append(str);
+// Like insert_at, but the whole lines of the clip go in as shared pieces.
+void Shard::insert_clip(size_t row, size_t col, const Clip& clip) {
+    if (clip.breaks() == 0) {
+        m_edit(row, col, 0).insert(col, clip.head());
+        return;
     }
-    if (lines.empty()) {
-        lines.push_back("");
+    std::string rest = clip.tail();
+    rest += buf->lines[row].substr(col);
+    m_edit(row, col, SIZE_MAX).replace(col, std::string::npos, clip.head());
+    mark_from(row + 1);
+    insert_lines(row + 1, std::move(rest));
+    insert_lines(row + 1, clip.lines());
+}
+
+// Copies the text between two positions into a clip; lines strictly inside
+// the range are shared with the buffer rather than copied.
+std::shared_ptr<const Clip> Shard::clip_range(size_t row, size_t col, size_t end_row, size_t end_col) {
+    if (row == end_row) {
+        return std::make_shared<const Clip>(std::string(buf->lines[row].substr(col, end_col - col)));
     }
+    return std::make_shared<const Clip>(std::string(buf->lines[row].substr(col)),
+                                        buf->lines.slices(row + 1, end_row - row - 1),
+                                        std::string(buf->lines[end_row].substr(0, end_col)));
 }
 
-void Shard::save(){
-    std::ofstream ofile(filename);
-    if(ofile.is_open()){
-        for (size_t i {}; i < lines.size(); ++i){
-            ofile << lines[i];
-            if (i < lines.size() - 1) {
-                ofile << '\n';
-            }
-        }
-        ofile.close();
-        status = " SAVED ";
-        color_pair = 4;
+static void text_end(size_t row, size_t col, const std::string& text, size_t& end_row, size_t& end_col) {
+    size_t last_break = text.rfind('\n');
+    if (last_break == std::string::npos) {
+        end_row = row;
+        end_col = col + text.length();
     } else {
-        status = " ERROR: Permission denied! File: " + filename;
-        color_pair = 5;
+        end_row = row + static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+        end_col = text.length() - last_break - 1;
     }
 }
 
-Shard::Shard(const std::string& file){
-    x = y = 0;
-    mode = 'n';
-    status = "NORMAL";
-    section = {};
-    scroll_offset = 0;
-    selecting = false;
-
-    if (file.empty()){
-        filename = "Untitled";
-    }else{
-        filename = file;
-    }
-
-    setlocale(LC_ALL, "");
-    initscr();
-    noecho();
-
-    struct termios old_t, new_t;
-    tcgetattr(STDIN_FILENO, &old_t);
-    new_t = old_t;
-    new_t.c_iflag &= ~(IXON | IXOFF);
-    new_t.c_lflag &= ~(ICANON | ECHO);
-    new_t.c_cc[VMIN] = 1;
-    new_t.c_cc[VTIME] = 0;
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_t);
-
-    cbreak();
-    keypad(stdscr, true);
-    intrflush(stdscr, FALSE);
-    signal(SIGINT, SIG_IGN);
-
-    if (has_colors()){
-        start_color();
-        init_pair(1, COLOR_BLACK, COLOR_GREEN);
-        init_pair(2, COLOR_BLACK, COLOR_MAGENTA);
-        init_pair(3, COLOR_WHITE, COLOR_BLACK);
-        init_pair(4, COLOR_BLACK, COLOR_WHITE);
-        init_pair(5, COLOR_BLACK, COLOR_MAGENTA);
-        init_pair(6, COLOR_BLACK, COLOR_YELLOW);
-    }
-    			
-    select_coords.start.y = -1;
-    select_coords.start.x = -1;
-    select_coords.end.y = -1;
-    select_coords.end.x = -1;
-
-    try {
-        open();
-    } catch (const std::runtime_error& e) {
-        endwin();
-        std::cerr << "Fatal Error: " << e.what() << std::endl;
-        throw;
+static void side_end(const Edit& edit, bool inserted, size_t& end_row, size_t& end_col) {
+    const std::shared_ptr<const Clip>& clip = inserted ? edit.inserted_clip : edit.removed_clip;
+    if (clip) {
+        clip->end(edit.y, edit.x, end_row, end_col);
+    } else {
+        text_end(edit.y, edit.x, inserted ? edit.inserted : edit.removed, end_row, end_col);
     }
-
-    clipboard = "";
 }
 
-Shard::~Shard(){
-    endwin();
+static bool single_line(const Edit& edit){
+    return !edit.removed_clip && !edit.inserted_clip &&
+           edit.removed.find('\n') == std::string::npos && edit.inserted.find('\n') == std::string::npos;
 }
 
-void Shard::run(){
-    refresh();
-    while(mode != 'q'){
-        update();
-        statusline();
-        print();
-        int c = getch();
-        input(c);
-    }
-}
+// Applies the entries of one journal step in order. Single-line edits never
+// move lines, so a long run of them is sorted by line (keeping their order
+// within a line) and every block of lines that enough of them fall in is
+// rebuilt into one piece; a step that touches most of the buffer costs one
+// pass over the touched blocks.
+void Shard::apply_step(const std::vector<Edit>& edits, bool forward){
+    size_t i = 0;
+    while (i < edits.size()) {
+        size_t j = i;
+        while (j < edits.size() && single_line(edits[j])) {
+            ++j;
+        }
+        if (j - i < REBUILD_EDITS) {
+            for (j = std::max(j, i + 1); i < j; ++i) {
+                journal_edit(edits[i], forward);
+                apply_edit(edits[i], forward);
+            }
+            continue;
+        }
 
-void Shard::update(){
-    if (status.find("ERROR") != std::string::npos || status.find("SAVED") != std::string::npos || 
-        status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos ||
-        status.find("CLIPBOARD") != std::string::npos || status.find("SELECTION") != std::string::npos ||
-        status.find("CUT") != std::string::npos) {
-        if (mode == 'n' && (status.find("SAVED") != std::string::npos || 
-            status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos || status.find("CUT") != std::string::npos)) {	
-             status = " NORMAL ";	
-             color_pair = 2;
-        } else if (mode == 'i' && (status.find("SAVED") != std::string::npos || 
-            status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos || status.find("CUT") != std::string::npos)) {	
-             status = " INSERT ";	
-             color_pair = 1;
+        std::vector<const Edit*> run;
+        for (; i < j; ++i) {
+            journal_edit(edits[i], forward);
+            run.push_back(&edits[i]);
         }
-    } else {
-        switch (mode){
-            case 27:
-            case 'n':
-                status = " NORMAL ";
-                color_pair = 2;
-                break;
-            case 'i':
-                status = " INSERT ";
-                color_pair = 1;
-                break;
-            case 'q':
-                break;
+        std::stable_sort(run.begin(), run.end(), [](const Edit* a, const Edit* b){ return a->y < b->y; });
+        size_t k = 0;
+        while (k < run.size()) {
+            size_t block = run[k]->y / REBUILD_LINES;
+            size_t next = k;
+            while (next < run.size() && run[next]->y / REBUILD_LINES == block) {
+                ++next;
+            }
+            if (next - k < REBUILD_EDITS) {
+                for (; k < next; ++k) {
+                    apply_edit(*run[k], forward);
+                }
+                continue;
+            }
+            size_t first = block * REBUILD_LINES;
+            size_t last = std::min(first + REBUILD_LINES, buf->lines.size());
+            std::string text;
+            for (size_t row = first; row < last; ++row) {
+                if (row > first) {
+                    text += '\n';
+                }
+                if (k == next || run[k]->y != row) {
+                    text += buf->lines[row];
+                    continue;
+                }
+                std::string line(buf->lines[row]);
+                for (; k < next && run[k]->y == row; ++k) {
+                    const Edit& edit = *run[k];
+                    line.replace(edit.x, (forward ? edit.removed : edit.inserted).length(), forward ? edit.inserted : edit.removed);
+                }
+                text += line;
+            }
+            mark_lines(first, last);
+            erase_lines(first, last - first);
+            insert_lines(first, std::move(text));
         }
     }
-    section = " | COLS: " + std::to_string(x) + " | ROWS: " + std::to_string(y) + " | FILE: " + filename + " | SharD ";
 }
 
-void Shard::statusline(){
-    attron(COLOR_PAIR(color_pair));
-    attron(A_BOLD);
-    mvprintw(LINES - 1, 0, "%*s", COLS, "");
-    mvprintw(LINES - 1, 0, status.c_str());
-    mvprintw(LINES - 1, static_cast<int>(status.length()), " ⵙ)");
-    mvprintw(LINES - 1, COLS - static_cast<int>(section.length()), section.c_str());
-    attroff(A_BOLD);
-    attroff(COLOR_PAIR(color_pair));
-    		
-    move(static_cast<int>(y - scroll_offset), static_cast<int>(x));	
-    refresh();
+void Shard::apply_edit(const Edit& edit, bool forward){
+    size_t end_row, end_col;
+    side_end(edit, !forward, end_row, end_col);
+    erase_range(edit.y, edit.x, end_row, end_col);
+    const std::shared_ptr<const Clip>& clip = forward ? edit.inserted_clip : edit.removed_clip;
+    if (clip) {
+        insert_clip(edit.y, edit.x, *clip);
+    } else {
+        insert_at(edit.y, edit.x, forward ? edit.inserted : edit.removed);
+    }
 }
 
-void Shard::start_selection() {
-    if (select_coords.start.y == -1) {
-        select_coords.start.x = static_cast<int>(x);
-        select_coords.start.y = static_cast<int>(y);
-        select_coords.end.x = static_cast<int>(x);
-        select_coords.end.y = static_cast<int>(y);
-        selecting = true;
-    }
+// Reverts or replays one journal step; the cost depends on the size of the
+// change only, never on the size of the buffer.
+void Shard::undo() {
+    std::vector<Edit> edits;
+    if (!buf->history.undo(edits)) return;
+    apply_step(edits, false);
+    clear_selection();
+    buf->selecting = false;
+    buf->x = edits.back().x;
+    goto_line(edits.back().y);
 }
 
-void Shard::update_selection() {
-    if (select_coords.start.y != -1) {
-        select_coords.end.x = static_cast<int>(x);
-        select_coords.end.y = static_cast<int>(y);
-        selecting = true;
-    }
+void Shard::redo() {
+    std::vector<Edit> edits;
+    if (!buf->history.redo(edits)) return;
+    apply_step(edits, true);
+    clear_selection();
+    buf->selecting = false;
+    const Edit& edit = edits.back();
+    size_t end_row, end_col;
+    side_end(edit, true, end_row, end_col);
+    buf->x = end_col;
+    goto_line(end_row);
 }
 
-void Shard::delete_selected_text() {
-    if (select_coords.start.y == -1) return;
-    Coords start = select_coords.start;
-    Coords end = select_coords.end;
-    if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
-        std::swap(start, end);
+void Shard::paste_before_line() {
+    clear_selection();
+    buf->selecting = false;
+
+    if (!buf->lines.empty() && buf->y == 0 && buf->lines[0].empty()) {
+        paste_at_cursor();
+        return;
     }
-    size_t start_y = static_cast<size_t>(start.y);
-    size_t start_x = static_cast<size_t>(start.x);
-    size_t end_y = static_cast<size_t>(end.y);
-    size_t end_x = static_cast<size_t>(end.x);
 
-    if (start_y >= lines.size() || end_y >= lines.size()) {
+    std::shared_ptr<const Clip> clip = paste_source();
+    if (!clip || clip->empty() || buf->lines.empty()) {
+        status = " CLIPBOARD EMPTY ";
+        color_pair = 5;
         return;
     }
     
-    if (start_y == end_y) {
-        if (end_x > start_x) {
-            lines[start_y].erase(start_x, end_x - start_x);
-        }
-        x = start_x;
-        y = start_y;
-    } else {
-        std::string remaining = lines[start_y].substr(0, start_x) +
-                                lines[end_y].substr(end_x);
-        		
-        for (size_t i = end_y; i > start_y; --i) {
-            m_remove(static_cast<int>(i));
-        }
-        		
-        lines[start_y] = remaining;
-        x = start_x;
-        y = start_y;
-    }
+    size_t paste_row = buf->y;
+    auto text = std::make_shared<const Clip>(clip->ends_with_break() ? *clip : clip->with_break_after());
+    record(paste_row, 0, nullptr, text);
+    insert_clip(paste_row, 0, *text);
+    paste_row += text->breaks();
+
+    buf->y = paste_row - (clip->breaks() == 0 ? 1 : 0);
+    buf->x = 0; 
+
+    status = " PASTED (BEFORE): " + std::to_string(clip->length()) + " chars ";
+    color_pair = 4;
 }
 
-void Shard::input(int c){
-    switch (c) {
-        case 'q':
-            if (mode == 'n') {
-                mode = 'q';
-                return;
-            }
-            		
-            if (mode == 'i') {	
-             	break;
-            }
-            return;	
+void Shard::paste_after_line() {
+    std::shared_ptr<const Clip> clip = paste_source();
+    if (!clip || clip->empty() || buf->lines.empty()) {
+        status = " CLIPBOARD EMPTY ";
+        color_pair = 5;
+        return;
+    }
 
-        case 'i':
-            if (mode != 'i') {	
-             	mode = 'i';
-             	return;	
-            }
-         	break;	
-
-        case 27:	
-         	mode = 'n';
-         	clear_selection();
-         	selecting = false;
-         	return;	
-
-        case 15:	
-         	if (mode == 'n'){
-             	save();
-         	}
-         	return;	
-         	 			
-        default:
-         	break;	
+    clear_selection();
+    buf->selecting = false;
+    
+    size_t paste_row = buf->y + 1;
+    
+    buf->x = 0;
+    if (paste_row < buf->lines.size()) {
+        auto text = std::make_shared<const Clip>(clip->ends_with_break() ? *clip : clip->with_break_after());
+        record(paste_row, 0, nullptr, text);
+        insert_clip(paste_row, 0, *text);
+    } else {
+        // after the last line: the text goes in behind a new line break instead
+        auto text = std::make_shared<const Clip>(clip->without_final_break().with_break_before());
+        record(buf->y, buf->lines[buf->y].length(), nullptr, text);
+        insert_clip(buf->y, buf->lines[buf->y].length(), *text);
     }
 
-    switch (mode){
-        case 'n':
-            switch (c) {
-                case 'w':
-                case 'W':
-                case 'k':
-                    up();
-                    break;
-                case 's':
-                case 'S':
-                case 'j':
-                    down();
-                    break;
-                case 'a':
-                case 'A':
-                case 'h':
-                    left();
-                    break;
-                case 'd':
-                case 'D':
-                case 'l':
-                    right();
-                    break;
-            }
-            break;
+    buf->y = buf->y + 1;	
+    buf->x = 0; 
 
-        case 'i':
-            switch(c){
-                
-                case KEY_UP:
-                    up();
-                    if (!selecting) clear_selection();
-                    break;
-                case KEY_DOWN:
-                    down();
-                    if (!selecting) clear_selection();
-                    break;
-                case KEY_LEFT:
-                    left();
-                    if (!selecting) clear_selection();
-                    break;
-                case KEY_RIGHT:
-                    right();
-                    if (!selecting) clear_selection();
-                    break;
-                
-                case 23: 
-                    if (y > 0) {
-                        if (!selecting) {
-                            start_selection();
-                            select_coords.start.x = 0;
-                            select_coords.end.x = lines[y].length();
-                        }
-                        
-                        up(); 
-                        
-                        if (y < static_cast<size_t>(select_coords.start.y)) {
-                            select_coords.start.y = static_cast<int>(y);
-                            select_coords.start.x = 0;	
-                        } else {
-                            select_coords.end.y = static_cast<int>(y);
-                            select_coords.end.x = lines[y].length();
-                        }
-
-                        if (y < scroll_offset) {
-                            --scroll_offset;
-                        }
-                    }
-                    break;
-
-                case 19: 
-                    if (y < lines.size() - 1) {
-                        if (!selecting) {
-                            start_selection();
-                            select_coords.start.x = 0;
-                            select_coords.end.x = lines[y].length();
-                        }
-
-                        down(); 
-                        
-                        if (y > static_cast<size_t>(select_coords.start.y)){
-                            select_coords.end.y = static_cast<int>(y);
-                            select_coords.end.x = lines[y].length();
-                        } else {
-                            select_coords.start.y = static_cast<int>(y);
-                            select_coords.start.x = 0;
-                        }
-
-                        size_t screen_height = LINES - 1;
-                        if (y >= scroll_offset + screen_height) {
-                            ++scroll_offset;
-                        }
-                    }
-                    break;
-                
-                case 1: 
-                    if (!selecting) {
-                        start_selection();
-                    }
-                    left();
-                    update_selection();
-                    break;
-                case 4: 
-                    if (!selecting) {
-                        start_selection();
-                    }
-                    right();
-                    update_selection();
-                    break;
-                
-                case 17: 
-                    if (select_coords.start.y != -1) {
-                        clipboard = get_selected_text();
-                        delete_selected_text();
-                        clear_selection();
-                        selecting = false;
-                        status = " CUT: " + std::to_string(clipboard.length()) + " chars ";
-                        color_pair = 5;	
-                    } else {
-                        status = " NO SELECTION TO CUT ";
-                        color_pair = 5;
-                    }
-                    break;
-
-                case 11: 
-                    if (select_coords.start.y != -1) {
-                        clipboard = get_selected_text();
-                        if (!clipboard.empty()) {
-                            status = " COPIED: " + std::to_string(clipboard.length()) + " chars ";
-                            color_pair = 4;
-                        } else {
-                            status = " COPY FAILED ";
-                            color_pair = 5;
-                        }
-                        clear_selection();
-                        selecting = false;
-                    } else if (y < lines.size()) {
-                        clipboard = lines[y]; 
-                        status = " COPIED LINE: " + std::to_string(clipboard.length()) + " chars ";
-                        color_pair = 4;
-                    }
-                    break;
-                    
-                case 22: 
-                    paste_at_cursor();
-                    break;
-                
-                case 25: 
-                    paste_before_line();
-                    break;
-                
-                case 16: 
-                    paste_after_line();
-                    break;
-                    
-                case 127:
-                case KEY_BACKSPACE:
-                    if (select_coords.start.y != -1) {
-                        delete_selected_text();
-                        clear_selection();
-                        selecting = false;
-                    } else {
-                        if (x == 0 && y > 0){
-                            if (y-1 < lines.size()) {
-                                x = lines[y-1].length();
-                                lines[y-1] += lines[y];
-                                m_remove(static_cast<int>(y));
-                                --y;
-                            }
-                        }
-                        else if (x > 0 && y < lines.size()){
-                            lines[y].erase(--x, 1);
-                        }
-                    }
-                    break;
-
-                case KEY_ENTER:
-                case 10:
-                    if (select_coords.start.y != -1) {
-                        delete_selected_text();
-                        clear_selection();
-                        selecting = false;
-                    }
-                                             
-                    if (y < lines.size()) {
-                        if (x < lines[y].length()){
-                            size_t chars_to_move = lines[y].length() - x;
-                            m_insert(lines[y].substr(x, chars_to_move), static_cast<int>(y + 1));
-                            lines[y].erase(x, chars_to_move);
-                        } else {
-                            m_insert("", static_cast<int>(y + 1));
-                        }
-
-                        x = 0;
-                        down();	
-                    }
-                    break;
-
-                case KEY_BTAB:
-                case KEY_CTAB:
-                case KEY_STAB:
-                case KEY_CATAB:
-                case 9:
-                    if (y < lines.size()) {
-                        lines[y].insert(x, 2, ' ');
-                        x += 2;
-                    }
-                    break;
-
-                case '(':
-                    if (y < lines.size()) {
-                        lines[y].insert(x, 2, ')');
-                        lines[y].replace(x, 1, "(");
-                        ++x;
-                    }
-                    break;
-
-                case '[':
-                    if (y < lines.size()) {
-                        lines[y].insert(x, 2, ']');
-                        lines[y].replace(x, 1, "[");
-                        ++x;
-                    }
-                    break;
-
-                case '{':
-                    if (y < lines.size()) {
-                        lines[y].insert(x, 2, '}');
-                        lines[y].replace(x, 1, "{");
-                        ++x;
-                    }
-                    break;
-                                        
-                default:
-                    if ((c >= 32 && c <= 126) || c > 255) {
-                        if (select_coords.start.y != -1) {
-                            delete_selected_text();
-                            clear_selection();
-                            selecting = false;
-                        }
-                                                
-                        if (y < lines.size()) {
-                            lines[y].insert(x, 1, static_cast<char>(c));
-                            ++x;
-                        }
-                    } else {
-                        if (selecting) {
-                            selecting = false;
-                        }
-                    }
-            }
-            break;
-    }
+    status = " PASTED (AFTER): " + std::to_string(clip->length()) + " chars ";
+    color_pair = 4;
 }
 
-void Shard::print(){
-    for (size_t i {}; i < (size_t)LINES-1; ++i){
-        size_t buffer_index = i + scroll_offset;
-        		
-        if (buffer_index >= lines.size()){
-            move(static_cast<int>(i), 0);
-            clrtoeol();
-        } else {
-            if (select_coords.start.y != -1 && selecting) {
-                Coords start = select_coords.start;
-                Coords end = select_coords.end;
-                			
-                if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
-                    std::swap(start, end);
-                }
-                			
-                size_t line_y = buffer_index;
-                const std::string& current_line = lines[buffer_index];
-                			
-                if (line_y >= static_cast<size_t>(start.y) && 
-                    line_y <= static_cast<size_t>(end.y)) {
-
-                    size_t sel_start = (line_y == static_cast<size_t>(start.y)) ? start.x : 0;
-                    size_t sel_end = (line_y == static_cast<size_t>(end.y)) ? end.x : current_line.length();
-
-                    sel_end = std::min(sel_end, current_line.length());
-                    sel_start = std::min(sel_start, current_line.length());
-                    					
-                    if (sel_start > 0) {
-                        mvprintw(static_cast<int>(i), 0, "%.*s", 
-                                 static_cast<int>(sel_start), 
-                                 current_line.c_str());
-                    }
-                    					
-                    if (sel_end > sel_start) {
-                        attron(A_REVERSE);
-                        size_t len = sel_end - sel_start;
-                        mvprintw(static_cast<int>(i), static_cast<int>(sel_start), "%.*s", 
-                                 static_cast<int>(len), 
-                                 current_line.c_str() + sel_start);
-                        attroff(A_REVERSE);
-                    }
-                    					
-                    if (sel_end < current_line.length()) {
-                        mvprintw(static_cast<int>(i), static_cast<int>(sel_end), "%s", 
-                                 current_line.c_str() + sel_end);
-                    }
-                } else {
-                    mvprintw(static_cast<int>(i), 0, current_line.c_str());
-                }
-            } else {
-                mvprintw(static_cast<int>(i), 0, lines[buffer_index].c_str());
-            }
-        }
-        clrtoeol();
+// Every copy or cut goes to the unnamed register and the front of the yank
+// ring, and also to the register picked with '"' before it, if any.
+void Shard::yank(std::shared_ptr<const Clip> clip) {
+    if (register_name >= 'a' && register_name <= 'z') {
+        registers[register_name] = clip;
     }
-    	
-    move(static_cast<int>(y - scroll_offset), static_cast<int>(x));	
+    register_name = 0;
+    yanks.push_front(clip);
+    if (yanks.size() > YANK_RING) {
+        yanks.pop_back();
+    }
+    clipboard = std::move(clip);
 }
 
-void Shard::m_remove(int number){
-    if (number >= 0 && static_cast<size_t>(number) < lines.size()) {
-        lines.erase(lines.begin() + number);
+// The clip to paste: the register picked with '"' ("a-"z, or "0-"9 for the
+// yank ring, newest first), otherwise the unnamed one.
+std::shared_ptr<const Clip> Shard::paste_source() {
+    char name = register_name;
+    register_name = 0;
+    if (name >= 'a' && name <= 'z') {
+        auto found = registers.find(name);
+        return found != registers.end() ? found->second : nullptr;
+    }
+    if (name >= '0' && name <= '9') {
+        size_t index = static_cast<size_t>(name - '0');
+        return index < yanks.size() ? yanks[index] : nullptr;
     }
+    return clipboard;
 }
 
-std::string Shard::m_tabs(std::string& line){
-    std::size_t pos = 0;
-    while ((pos = line.find('\t')) != std::string::npos) {
-        line.replace(pos, 1, " ");
+void Shard::select_register(int c) {
+    if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+        register_name = static_cast<char>(c);
+        status = std::string(" REGISTER \"") + register_name + " ";
+        color_pair = 4;
+    } else {
+        status = " ERROR: No such register ";
+        color_pair = 5;
     }
-    return line;
 }
 
-void Shard::m_insert(std::string line, int number){
-    line = m_tabs(line);
-    size_t insert_pos = (number >= 0 && static_cast<size_t>(number) <= lines.size()) ? static_cast<size_t>(number) : lines.size();
-    lines.insert(lines.begin() + insert_pos, line);
-}
+void Shard::open() {
+    struct stat buffer;
+    if (stat(buf->filename.c_str(), &buffer) == 0){
+        auto file = std::make_shared<MappedFile>(buf->filename);
+        file->index(static_cast<size_t>(term->rows()));
+        file->load();
+        buf->file_bytes = file->mapped();
+        buf->file = file;
+        buf->lines.assign(file);
+    } else {
+        std::string str {};
+        m_append(str);
+    }
+    if (buf->lines.empty()) {
+        buf->lines.push_back("");
+    }
 
-void Shard::m_append(std::string& line){
-    line = m_tabs(line);
-    lines.push_back(line);
+    bool current = false;
+    if (Journal::read(buf->filename, buf->recovered, current) && !buf->recovered.empty()) {
+        if (current) {
+            mode = 'r';
+            return;
+        }
+        status = " ERROR: File changed since the journal was written, journal discarded ";
+        color_pair = 5;
+        Journal::discard(buf->filename);
+    }
+    buf->recovered.clear();
 }
 
-void Shard::up(){
-    if(y > 0){
-        --y;
+// The journal is only created with the first edit, so a file that is just
+// looked at leaves nothing beside it. One that cannot be created is reported
+// once and not tried again.
+bool Shard::start_journal(Buffer& buffer){
+    if (journal_interval == 0 || buffer.scratch || buffer.journal_failed) {
+        return false;
     }
-    	
-    if (y < scroll_offset) {
-             --scroll_offset;
+    if (!buffer.journal.start(buffer.filename, false, journal_interval)) {
+        buffer.journal_failed = true;
+        status = " ERROR: Could not open " + Journal::path_for(buffer.filename) + " ";
+        color_pair = 5;
+        return false;
     }
-
-    if (y < lines.size() && x > lines[y].length()){
-        x = lines[y].length();
+    if (buffer.saving) {
+        // edits from here on must outlive the save that is running
+        buffer.journal.checkpoint();
     }
+    return true;
 }
 
-void Shard::right(){
-    if (y < lines.size() && x < lines[y].length()){
-        ++x;
+// Every edit, undo and redo passes through here.
+void Shard::journal_edit(const Edit& edit, bool forward){
+    ++buf->version;
+    if (buf->journal.active() || start_journal(*buf)) {
+        buf->journal.append(edit, forward);
     }
 }
 
-void Shard::left(){
-    if(x > 0){
-        --x;
+// The whole text as a clip that shares the lines rather than copying them.
+static std::shared_ptr<const Clip> whole_text(const TextBuffer& lines){
+    size_t last = lines.size() - 1;
+    if (last == 0) {
+        return std::make_shared<const Clip>(std::string(lines[0]));
     }
+    return std::make_shared<const Clip>(std::string(lines[0]), lines.slices(1, last - 1), std::string(lines[last]));
 }
 
-void Shard::down(){
-    size_t screen_height = LINES - 1;
-
-    if(y < lines.size() - 1){
-        ++y;
+// Starts the journal of a buffer that was edited while journaling was off.
+// Those edits were never written, so the journal opens with one record that
+// turns the file on disk into the buffer as it is now; a buffer without
+// edits starts its journal with the next one as usual.
+void Shard::resume_journal(Buffer& buffer){
+    if (!buffer.modified() || buffer.journal.active()) {
+        return;
     }
-
-    if (y >= scroll_offset + screen_height) {
-               ++scroll_offset;
+    TextBuffer disk;
+    struct stat st;
+    try {
+        if (stat(buffer.filename.c_str(), &st) == 0) {
+            auto file = std::make_shared<MappedFile>(buffer.filename);
+            file->load();
+            disk.assign(file);
+            disk.wait();
+        }
+    } catch (const std::runtime_error& e) {
+        status = std::string(" ERROR: ") + e.what() + " ";
+        color_pair = 5;
+        return;
     }
-
-    if(y < lines.size() && x > lines[y].length()){
-        x = lines[y].length();
+    if (disk.empty()) {
+        disk.push_back("");
+    }
+    buffer.lines.wait();
+    if (!start_journal(buffer)) {
+        return;
     }
+    Edit edit;
+    edit.removed_clip = whole_text(disk);
+    edit.inserted_clip = whole_text(buffer.lines);
+    buffer.journal.append(edit, true);
 }
 
-std::string Shard::get_selected_text(){
-    if (select_coords.start.y == -1) return "";
-    std::string selected_text = "";
-    Coords start = select_coords.start;
-    Coords end = select_coords.end;
-    
-    if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
-        std::swap(start, end);
+void Shard::recovery_input(int c){
+    if (c == 'y' || c == 'Y') {
+        recover();
+    } else if (c == 'n' || c == 'N' || c == 27) {
+        buf->recovered.clear();
+        buf->recovered.shrink_to_fit();
+        Journal::discard(buf->filename);
+    } else {
+        return;
     }
+    mode = 'n';
+}
 
-    size_t start_y = static_cast<size_t>(start.y);
-    size_t start_x = static_cast<size_t>(start.x);
-    size_t end_y = static_cast<size_t>(end.y);
-    size_t end_x = static_cast<size_t>(end.x);
-    		
-    if (start_y >= lines.size() || end_y >= lines.size()) {
-        return "";
+// Whether the text an edit removes is in the buffer where the edit says.
+bool Shard::fits(const Edit& edit){
+    size_t row = edit.y;
+    size_t col = edit.x;
+    std::string_view removed = edit.removed;
+    for (;;) {
+        if (row >= buf->lines.size()) {
+            return false;
+        }
+        std::string_view line = buf->lines[row];
+        size_t line_break = removed.find('\n');
+        std::string_view part = removed.substr(0, line_break);
+        if (col > line.length() || line.substr(col, part.length()) != part) {
+            return false;
+        }
+        if (line_break == std::string_view::npos) {
+            return true;
+        }
+        if (col + part.length() != line.length()) {
+            return false;
+        }
+        removed.remove_prefix(line_break + 1);
+        ++row;
+        col = 0;
     }
+}
 
-    if (start_y == end_y) {
-        if (start_x < lines[start_y].length()) {
-            size_t len = end_x > start_x ? end_x - start_x : 0;
-            if (start_x + len > lines[start_y].length()) {
-                len = lines[start_y].length() - start_x;
+// Replays the journal left by a crash as one undo step. Every record is
+// checked against the text it removes before it is applied, and the first
+// one that does not match ends the replay, so a damaged journal can neither
+// take the editor down nor leave edits in the undo step that were never
+// made. Runs of single-line records are checked on copies of their lines and
+// then applied together.
+void Shard::recover(){
+    auto started = std::chrono::steady_clock::now();
+    buf->lines.wait();
+    std::vector<Edit>& edits = buf->recovered;
+    size_t total = edits.size();
+    size_t valid = 0;
+    while (valid < edits.size()) {
+        std::unordered_map<size_t, std::string> lines;
+        size_t end = valid;
+        for (; end < edits.size() && single_line(edits[end]); ++end) {
+            const Edit& edit = edits[end];
+            if (edit.y >= buf->lines.size()) {
+                break;
             }
-            selected_text = lines[start_y].substr(start_x, len);
-        }
-    } else {
-        if (start_x < lines[start_y].length()) {
-            selected_text += lines[start_y].substr(start_x);
+            auto line = lines.find(edit.y);
+            if (line == lines.end()) {
+                line = lines.emplace(edit.y, std::string(buf->lines[edit.y])).first;
+            }
+            if (edit.x > line->second.length() || line->second.compare(edit.x, edit.removed.length(), edit.removed) != 0) {
+                break;
+            }
+            line->second.replace(edit.x, edit.removed.length(), edit.inserted);
         }
-        selected_text += '\n';
-
-        for (size_t i = start_y + 1; i < end_y && i < lines.size(); ++i) {
-             selected_text += lines[i] + '\n';
+        if (end > valid) {
+            apply_step(std::vector<Edit>(edits.begin() + valid, edits.begin() + end), true);
+            valid = end;
+            continue;
         }
-        		
-        if (end_y < lines.size() && end_x > 0) {
-            size_t len = end_x;
-            if (len > lines[end_y].length()) {
-                len = lines[end_y].length();
-            }
-            selected_text += lines[end_y].substr(0, len);
+        if (!fits(edits[valid])) {
+            break;
         }
+        journal_edit(edits[valid], true);
+        apply_edit(edits[valid], true);
+        ++valid;
+    }
+    edits.resize(valid);
+
+    bool damaged = valid < total;
+    if (!edits.empty()) {
+        const Edit& edit = edits.back();
+        size_t end_row, end_col;
+        side_end(edit, true, end_row, end_col);
+        buf->x = end_col;
+        buf->y = std::min(end_row, buf->lines.size() - 1);
+        buf->history.record_group(std::move(edits));
+    }
+    buf->recovered.clear();
+    buf->recovered.shrink_to_fit();
+    buf->layouts.clear();
+    mark_all();
+    goto_line(buf->y);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    if (damaged) {
+        status = " ERROR: Journal does not match the file, recovered " + std::to_string(valid) + " edits ";
+        color_pair = 5;
+    } else {
+        status = " RECOVERED: " + std::to_string(valid) + " edits in " + std::to_string(elapsed.count()) + "ms ";
+        color_pair = 4;
+    }
+}
+
+// Writes a snapshot of the buffer, on a background thread unless that is
+// turned off with ":set nobgsave"; editing can go on while it runs.
+void Shard::save(){
+    if (buf->scratch) {
+        status = " ERROR: " + buf->filename + " is not a file ";
+        color_pair = 5;
+        return;
+    }
+    if (buf->saving) {
+        status = " ERROR: Save already in progress ";
+        color_pair = 5;
+        return;
+    }
+    // a file with other links is written in place, and the job copies the buffer off it first
+    buf->saving = std::make_unique<SaveJob>(buf->lines.snapshot(), buf->filename, buf->file.lock());
+    buf->saving_version = buf->version;
+    buf->journal.checkpoint();
+    if (background_save) {
+        buf->saving->start();
+    } else {
+        buf->saving->run();
+        finish_save(*buf);
+    }
+}
+
+static std::string megabytes(double bytes){
+    char text[32];
+    snprintf(text, sizeof(text), "%.1fMB", bytes / (1 << 20));
+    return text;
+}
+
+void Shard::finish_save(Buffer& buffer){
+    if (buffer.saving->ok()) {
+        double seconds = buffer.saving->seconds();
+        status = " SAVED: " + megabytes(static_cast<double>(buffer.saving->total())) + " in " +
+                 std::to_string(static_cast<int>(seconds * 1000)) + "ms (" +
+                 megabytes(seconds > 0 ? buffer.saving->total() / seconds : 0) + "/s) ";
+        color_pair = 4;
+        buffer.journal.restart();
+        buffer.saved_version = buffer.saving_version;
+        buffer.file_bytes = buffer.saving->total();
+        if (buffer.following) {
+            buffer.follower.start(buffer.filename, buffer.file_bytes);
+        }
+    } else {
+        buffer.journal.cancel_checkpoint();
+        status = " ERROR: " + buffer.saving->error() + " ";
+        color_pair = 5;
+    }
+    buffer.saving.reset();
+}
+
+// Follow mode: bytes appended to the file are added to the end of the
+// buffer as they arrive, and a cursor on the last line stays there.
+// Edits that are not saved would be lost if the file restarts, so following
+// waits until they are.
+void Shard::start_follow(){
+    if (buf->modified()) {
+        status = " ERROR: No write since last change, save before following ";
+        color_pair = 5;
+        return;
+    }
+    if (!buf->follower.start(buf->filename, buf->file_bytes)) {
+        status = " ERROR: Cannot watch " + buf->filename + " ";
+        color_pair = 5;
+        buf->following = false;
+        return;
+    }
+    buf->following = true;
+    goto_line(SIZE_MAX - 1);
+}
+
+void Shard::stop_follow(){
+    buf->file_bytes = buf->follower.position();
+    buf->follower.stop();
+    buf->following = false;
+}
+
+// Appends what was written since the last poll. The new rows come in
+// through the usual paths: a pinned view scrolls and draws only the rows
+// that appeared, and the line that was extended is redrawn alone.
+void Shard::follow(){
+    bool joined = buf->follower.open_line();
+    std::string data;
+    Follower::Change change = buf->follower.poll(data, FOLLOW_CHUNK);
+    if (change == Follower::NONE) {
+        return;
+    }
+    bool pinned = buf->y + 1 >= buf->lines.size();
+    if (change == Follower::RESTARTED) {
+        // the buffer, registers and undo may still hold pages of the mapping
+        if (std::shared_ptr<MappedFile> file = buf->file.lock()) {
+            file->truncated(buf->filename);
+        }
+        if (buf->modified()) {
+            stop_follow();
+            status = " ERROR: " + buf->filename + " was truncated, stopped following to keep your edits ";
+            color_pair = 5;
+            return;
+        }
+        // the journal and undo steps were against the text that is gone
+        buf->journal.stop(true);
+        buf->lines.clear();
+        buf->lines.push_back("");
+        buf->syntax.clear();
+        buf->history.clear();
+        buf->layouts.clear();
+        clear_selection();
+        buf->selecting = false;
+        buf->x = buf->y = buf->scroll_offset = buf->scroll_row = 0;
+        mark_all();
+        joined = true;
+        pinned = true;
+        status = " FOLLOW: " + buf->filename + " was truncated, reading it from the start ";
+        color_pair = 4;
+    }
+    if (!data.empty() && data.back() == '\n') {
+        data.pop_back();
+    } else if (data.empty()) {
+        return;
+    }
+
+    size_t last = buf->lines.size() - 1;
+    size_t first_break = data.find('\n');
+    if (!joined) {
+        m_append(std::move(data));
+    } else if (first_break == std::string::npos) {
+        m_edit(last, buf->lines[last].length(), 0).append(data);
+    } else {
+        m_edit(last, buf->lines[last].length(), 0).append(data, 0, first_break);
+        m_append(data.substr(first_break + 1));
+    }
+    if (pinned) {
+        goto_line(buf->lines.size() - 1);
+    }
+}
+
+// Searches every file under the working directory. The results buffer is
+// reused by each search and fills up as the workers report; workers are at
+// least GREP_MIN_THREADS even on one core so reads of cold files overlap.
+void Shard::start_grep(const std::string& needle){
+    grep.reset();
+    if (grep_buffer == SIZE_MAX) {
+        auto buffer = std::make_unique<Buffer>();
+        buffer->filename = "[grep]";
+        buffer->scratch = true;
+        buffer->loaded = true;
+        buffer->layouts.set_tab_width(buf->layouts.tab_width());
+        buffers.push_back(std::move(buffer));
+        grep_buffer = buffers.size() - 1;
+    }
+    switch_buffer(grep_buffer);
+    buf->lines.clear();
+    buf->lines.push_back("grep: " + needle);
+    buf->syntax.clear();
+    buf->history.clear();
+    buf->layouts.clear();
+    clear_selection();
+    buf->selecting = false;
+    buf->x = buf->y = buf->scroll_offset = buf->col_offset = buf->scroll_row = 0;
+    mark_all();
+
+    unsigned threads = std::max(GREP_MIN_THREADS, std::thread::hardware_concurrency());
+    grep = std::make_unique<GrepJob>(".", needle, threads);
+    grep->start();
+}
+
+// Appends the hits reported since the last frame to the results buffer as
+// one block, whichever buffer is in view.
+void Shard::poll_grep(){
+    bool finished = grep->done();
+    std::vector<GrepHit> hits;
+    if (grep->take(hits)) {
+        std::string block;
+        for (const GrepHit& hit : hits) {
+            block += hit.path + ":" + std::to_string(hit.line) + ": " + hit.text + "\n";
+        }
+        block.pop_back();
+        Buffer& results = *buffers[grep_buffer];
+        size_t before = results.lines.size();
+        results.lines.push_back(std::move(block));
+        results.syntax.inserted(before, results.lines.size() - before);
+    }
+    if (finished) {
+        status = " GREP: " + std::to_string(grep->found()) + " hits in " + std::to_string(grep->files()) + " files (" +
+                 std::to_string(static_cast<int>(grep->seconds() * 1000)) + "ms) ";
+        color_pair = 4;
+        grep.reset();
+    }
+}
+
+// Opens the file of the result under the cursor at its line. Results read
+// PATH:LINE: TEXT; the first :LINE: ends the path, so paths may hold colons.
+void Shard::open_hit(){
+    if (!buf->scratch) {
+        return;
+    }
+    std::string_view line = buf->lines[buf->y];
+    for (size_t colon = line.find(':'); colon != std::string_view::npos; colon = line.find(':', colon + 1)) {
+        size_t end = colon + 1;
+        while (end < line.length() && isdigit(static_cast<unsigned char>(line[end]))) {
+            ++end;
+        }
+        if (end == colon + 1 || end == line.length() || line[end] != ':' || colon == 0) {
+            continue;
+        }
+        size_t number = strtoul(std::string(line.substr(colon + 1, end - colon - 1)).c_str(), nullptr, 10);
+        size_t index = add_buffer(std::string(line.substr(0, colon)));
+        switch_buffer(index);
+        if (current == index) {
+            buf->x = 0;
+            goto_line(number > 0 ? number - 1 : 0);
+        }
+        return;
+    }
+}
+
+// The picker lists the files under the working directory best match first
+// and narrows the list as the query is typed. The index is refreshed each
+// time the picker opens; until the walk is done it shows the cached list.
+void Shard::open_finder(){
+    if (!file_index) {
+        file_index = std::make_unique<FileIndex>(".");
+    }
+    file_index->refresh(std::max(GREP_MIN_THREADS, std::thread::hardware_concurrency()));
+    finder_query.clear();
+    finder.set_query(finder_query);
+    finder_selected = 0;
+    mode = 'p';
+}
+
+void Shard::finder_input(int c){
+    switch (c) {
+        case 27:
+            mode = 'n';
+            mark_all();
+            return;
+        case KEY_ENTER:
+        case 10: {
+            const std::vector<FinderMatch>& best = finder.best(static_cast<size_t>(term->rows() - 1));
+            mode = 'n';
+            mark_all();
+            if (finder_selected < best.size()) {
+                switch_buffer(add_buffer(std::string(finder.path(best[finder_selected].file))));
+            }
+            return;
+        }
+        case KEY_UP:
+        case 16:
+            finder_selected -= finder_selected > 0 ? 1 : 0;
+            return;
+        case KEY_DOWN:
+        case 14:
+            ++finder_selected;
+            return;
+        case 127:
+        case KEY_BACKSPACE:
+            if (!finder_query.empty()) {
+                finder_query.pop_back();
+            }
+            break;
+        default:
+            if (c < 32 || c > 255 || c == 127 || finder_query.length() >= FINDER_QUERY) {
+                return;
+            }
+            finder_query += static_cast<char>(c);
+            break;
+    }
+    finder.set_query(finder_query);
+    finder_selected = 0;
+}
+
+// Draws the best matches over the text, one per row with the matched
+// characters picked out; a path too long for the row loses its start.
+void Shard::draw_finder(){
+    size_t height = static_cast<size_t>(term->rows() - 1);
+    size_t width = static_cast<size_t>(term->cols());
+    const std::vector<FinderMatch>& best = finder.best(height);
+    if (finder_selected >= best.size()) {
+        finder_selected = best.empty() ? 0 : best.size() - 1;
+    }
+    std::vector<size_t> matched;
+    for (size_t row = 0; row < height; ++row) {
+        term->place(static_cast<int>(row), 0);
+        term->clear_line();
+        if (row >= best.size()) {
+            continue;
+        }
+        std::string_view path = finder.path(best[row].file);
+        finder.positions(best[row].file, matched);
+        size_t skip = path.length() >= width ? path.length() - width + 1 : 0;
+        if (row == finder_selected) {
+            term->attribute_on(A_REVERSE);
+            term->put(std::string(width, ' '));
+            term->place(static_cast<int>(row), 0);
+        }
+        size_t next = 0;
+        for (size_t from = skip; from < path.length(); ) {
+            while (next < matched.size() && matched[next] < from) {
+                ++next;
+            }
+            if (next < matched.size() && matched[next] == from) {
+                term->attribute_on(COLOR_PAIR(7) | A_BOLD);
+                term->put(path.substr(from, 1));
+                term->attribute_off(COLOR_PAIR(7) | A_BOLD);
+                ++from;
+            } else {
+                size_t to = next < matched.size() ? matched[next] : path.length();
+                term->put(path.substr(from, to - from));
+                from = to;
+            }
+        }
+        if (row == finder_selected) {
+            term->attribute_off(A_REVERSE);
+        }
+    }
+    frame_rows = height;
+}
+
+Shard::Shard(const std::string& file, std::unique_ptr<Terminal> terminal)
+    : Shard(std::vector<std::string>{file}, std::move(terminal)){}
+
+Shard::Shard(const std::vector<std::string>& files, std::unique_ptr<Terminal> terminal){
+    buf = nullptr;
+    current = 0;
+    mode = 'n';
+    status = "NORMAL";
+    section = {};
+    wrapping = false;
+    register_name = 0;
+    color_pair = 2;
+    pending_line = SIZE_MAX;
+    prefix = 0;
+    escape_timeout = ESCAPE_TIMEOUT;
+    key_timeout = KEY_TIMEOUT;
+    search_failed = false;
+    highlighting = false;
+    message = false;
+    background_save = true;
+    discarding = false;
+    journal_interval = JOURNAL_INTERVAL;
+    grep_buffer = SIZE_MAX;
+    finder_selected = 0;
+    hud = false;
+    usage_buffer = nullptr;
+    usage_heap = 0;
+    usage_mapped = 0;
+    if (const char* path = getenv("SHARD_LATENCY_LOG")) {
+        latency_path = path;
+        latency.keep(true);
+    }
+    drawn_lines = 0;
+    frame_rows = 0;
+    frame_bytes = 0;
+
+    term = terminal ? std::move(terminal) : std::make_unique<NcursesTerminal>();
+    term->set_escape_timeout(escape_timeout);
+
+    for (const std::string& file : files) {
+        add_buffer(file.empty() ? "Untitled" : file);
+    }
+    if (buffers.empty()) {
+        add_buffer("Untitled");
+    }
+
+    try {
+        switch_buffer(0);
+    } catch (const std::runtime_error& e) {
+        term.reset();
+        std::cerr << "Fatal Error: " << e.what() << std::endl;
+        throw;
+    }
+    load_config();
+}
+
+Shard::~Shard(){
+    grep.reset();
+    file_index.reset();
+    for (auto& buffer : buffers) {
+        buffer->saving.reset();
+        // a journal with edits nothing else holds is left for recovery
+        buffer->journal.stop(discarding || !buffer->modified());
+    }
+    term.reset();
+    if (!latency_path.empty() && !latency.dump(latency_path)) {
+        std::cerr << "Could not write latency log: " << latency_path << std::endl;
+    }
+}
+
+// Buffers are kept by path, so naming a file twice finds the open buffer.
+size_t Shard::add_buffer(const std::string& file){
+    char* resolved = realpath(file.c_str(), nullptr);
+    std::string key = resolved ? resolved : file;
+    free(resolved);
+    auto found = registry.find(key);
+    if (found != registry.end()) {
+        return found->second;
+    }
+    auto buffer = std::make_unique<Buffer>();
+    buffer->filename = file;
+    buffer->syntax.set_language(language_for(file));
+    if (buf) {
+        buffer->layouts.set_tab_width(buf->layouts.tab_width());
+    }
+    buffers.push_back(std::move(buffer));
+    registry.emplace(key, buffers.size() - 1);
+    return buffers.size() - 1;
+}
+
+// Points the editor at another buffer; its text is read on the first visit.
+void Shard::switch_buffer(size_t index){
+    if (index >= buffers.size()) {
+        return;
+    }
+    if (mode == 'r' || mode == 'i') {
+        mode = 'n';
+    }
+    Buffer* previous = buf;
+    size_t previous_index = current;
+    current = index;
+    buf = buffers[index].get();
+    pending_line = SIZE_MAX;
+    drawn_lines = 0;
+    drawn_selection = Selection();
+    mark_all();
+    if (!buf->loaded) {
+        buf->loaded = true;
+        try {
+            open();
+        } catch (const std::runtime_error& e) {
+            buf->loaded = false;
+            if (!previous) {
+                throw;
+            }
+            buf = previous;
+            current = previous_index;
+            status = std::string(" ERROR: ") + e.what() + " ";
+            color_pair = 5;
+        }
+    } else if (!buf->recovered.empty()) {
+        mode = 'r';
+    }
+}
+
+void Shard::list_buffers(){
+    status = " ";
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        status += (i == current ? "[" : "") + std::to_string(i + 1) + ":" + buffers[i]->filename +
+                  (i == current ? "] " : " ");
+    }
+    color_pair = 4;
+}
+
+bool Shard::saves_pending() const {
+    for (const auto& buffer : buffers) {
+        if (buffer->saving) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Shard::run(){
+    while(mode != 'q'){
+        frame();
+    }
+}
+
+static double elapsed_us(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to){
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+// Draws the screen, waits for a key and applies it along with every key that
+// is already queued, so typeahead costs one frame instead of one per key.
+// Iterations that handled keys are timed phase by phase, without the wait.
+void Shard::frame(){
+    using clock = std::chrono::steady_clock;
+    FrameTiming timing;
+    auto drawn = clock::now();
+    if (mode == 'p') {
+        draw_finder();
+    } else {
+        print();
+    }
+    if (hud) {
+        draw_hud();
+    }
+    auto printed = clock::now();
+    update();
+    auto updated = clock::now();
+    statusline();
+    auto shown_at = clock::now();
+    timing.us[PHASE_PRINT] = elapsed_us(drawn, printed);
+    timing.us[PHASE_UPDATE] = elapsed_us(printed, updated);
+    timing.us[PHASE_STATUS] = elapsed_us(updated, shown_at);
+
+    std::string shown = status;
+    bool indexing = file_index && file_index->refreshing();
+    int wait = buf->lines.loading() || saves_pending() || grep || indexing ? 100 : -1;
+    if (buf->following) {
+        wait = buf->follower.behind() ? 0 : FOLLOW_POLL_MS;
+    }
+    if (!pending_keys.empty()) {
+        wait = wait < 0 ? key_wait() : std::min(wait, key_wait());
+    }
+    int c = term->read_key(wait);
+    auto received = clock::now();
+
+    int handled = 0;
+    for (; c != ERR && mode != 'q' && handled < TYPEAHEAD_LIMIT; ++handled) {
+        if (c == KEY_RESIZE) {
+            mark_all();
+        } else if (c == KEY_PASTE_BEGIN) {
+            pending_line = SIZE_MAX;
+            decode_keys(true);
+            paste_bracketed();
+        } else {
+            pending_line = SIZE_MAX;
+            input(c);
+        }
+        // a key is only read when it will be handled; the rest wait for the next frame
+        c = handled + 1 < TYPEAHEAD_LIMIT ? term->read_key(0) : ERR;
+    }
+    if (!pending_keys.empty() && key_wait() == 0) {
+        decode_keys(true);
+    }
+    if (pending_line != SIZE_MAX && (pending_line < buf->lines.size() || !buf->lines.loading())) {
+        goto_line(pending_line);
+    }
+    for (auto& buffer : buffers) {
+        if (buffer->saving && buffer->saving->done()) {
+            finish_save(*buffer);
+        }
+    }
+    if (buf->following && !buf->lines.loading()) {
+        follow();
+    }
+    if (grep) {
+        poll_grep();
+    }
+    std::shared_ptr<const FileList> files;
+    if (file_index && file_index->take(files)) {
+        finder.set_files(std::move(files));
+    }
+    message = status != shown;
+    if (handled > 0) {
+        timing.us[PHASE_INPUT] = elapsed_us(received, clock::now());
+        latency.record(timing);
+    }
+}
+
+bool Shard::running() const {
+    return mode != 'q';
+}
+
+void Shard::update(){
+    if (mode == '/') {
+        status = " /" + search_query + (search_failed ? " (NOT FOUND) " : " ");
+        color_pair = 6;
+    } else if (mode == ':') {
+        status = " :" + command_line + " ";
+        color_pair = 6;
+    } else if (mode == 'p') {
+        status = " > " + finder_query + " ";
+        color_pair = 6;
+    } else if (mode == 'r') {
+        status = " RECOVER " + std::to_string(buf->recovered.size()) + " EDITS? (y/n) ";
+        color_pair = 6;
+    } else if (message) {
+        message = false;
+    } else if (status.find("ERROR") != std::string::npos || status.find("SAVED") != std::string::npos || 
+        status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos ||
+        status.find("CLIPBOARD") != std::string::npos || status.find("SELECTION") != std::string::npos ||
+        status.find("CUT") != std::string::npos) {
+        if (mode == 'n' && (status.find("SAVED") != std::string::npos || 
+            status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos || status.find("CUT") != std::string::npos)) {	
+             status = " NORMAL ";	
+             color_pair = 2;
+        } else if (mode == 'i' && (status.find("SAVED") != std::string::npos || 
+            status.find("COPIED") != std::string::npos || status.find("PASTED") != std::string::npos || status.find("CUT") != std::string::npos)) {	
+             status = " INSERT ";	
+             color_pair = 1;
+        }
+    } else {
+        switch (mode){
+            case 27:
+            case 'n':
+                status = " NORMAL ";
+                color_pair = 2;
+                break;
+            case 'i':
+                status = " INSERT ";
+                color_pair = 1;
+                break;
+            case 'q':
+                break;
+        }
+    }
+    section = " | COLS: " + std::to_string(buf->x) + " | ROWS: " + std::to_string(buf->y) + " | FILE: " + buf->filename +
+              (buffers.size() > 1 ? " [" + std::to_string(current + 1) + "/" + std::to_string(buffers.size()) + "]" : "") + " | SharD ";
+    section = " | FRAME: " + std::to_string(frame_rows) + "r/" + std::to_string(frame_bytes) + "B" + section;
+    if (buf->saving && buf->saving->copied() < buf->saving->copy_total()) {
+        section = " | COPYING: " + std::to_string(static_cast<int>(buf->saving->copied() * 100.0 / buf->saving->copy_total())) +
+                  "%" + section;
+    } else if (buf->saving) {
+        double seconds = buf->saving->seconds();
+        double written = static_cast<double>(buf->saving->written());
+        section = " | SAVING: " + std::to_string(buf->saving->total() ? static_cast<int>(written * 100 / buf->saving->total()) : 100) +
+                  "% " + megabytes(seconds > 0 ? written / seconds : 0) + "/s" + section;
+    }
+    if (buf->following) {
+        section = " | FOLLOW" + section;
+    }
+    if (mode == 'p') {
+        section = " | FILES: " + std::to_string(finder.matched()) + "/" + std::to_string(finder.total()) +
+                  (file_index->refreshing() ? " INDEXING" : "") + section;
+    }
+    if (grep) {
+        section = " | GREP: " + std::to_string(grep->files()) + " files " + std::to_string(grep->found()) + " hits" + section;
+    }
+    if (buf->lines.loading()) {
+        section = " | LOADING: " + std::to_string(static_cast<int>(buf->lines.progress() * 100)) + "%" + section;
+    }
+}
+
+void Shard::statusline(){
+    int row = term->rows() - 1;
+    term->attribute_on(COLOR_PAIR(color_pair));
+    term->attribute_on(A_BOLD);
+    term->place(row, 0);
+    term->put(std::string(static_cast<size_t>(term->cols()), ' '));
+    term->place(row, 0);
+    term->put(status);
+    term->put(" ⵙ)");
+    term->place(row, term->cols() - static_cast<int>(display_width(section)));
+    term->put(section);
+    term->attribute_off(A_BOLD);
+    term->attribute_off(COLOR_PAIR(color_pair));
+
+    if (mode == 'p') {
+        term->place(row, static_cast<int>(display_width(status)) - 1);
+    } else {
+        place_cursor();
+    }
+    term->flush();
+}
+
+void Shard::start_selection() {
+    if (buf->select_coords.start.y == -1) {
+        buf->select_coords.start.x = static_cast<int>(buf->x);
+        buf->select_coords.start.y = static_cast<int>(buf->y);
+        buf->select_coords.end.x = static_cast<int>(buf->x);
+        buf->select_coords.end.y = static_cast<int>(buf->y);
+        buf->selecting = true;
+    }
+}
+
+void Shard::update_selection() {
+    if (buf->select_coords.start.y != -1) {
+        buf->select_coords.end.x = static_cast<int>(buf->x);
+        buf->select_coords.end.y = static_cast<int>(buf->y);
+        buf->selecting = true;
+    }
+}
+
+void Shard::delete_selected_text() {
+    if (buf->select_coords.start.y == -1) return;
+    Coords start = buf->select_coords.start;
+    Coords end = buf->select_coords.end;
+    if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
+        std::swap(start, end);
+    }
+    size_t start_y = static_cast<size_t>(start.y);
+    size_t start_x = static_cast<size_t>(start.x);
+    size_t end_y = static_cast<size_t>(end.y);
+    size_t end_x = static_cast<size_t>(end.x);
+
+    if (start_y >= buf->lines.size() || end_y >= buf->lines.size()) {
+        return;
+    }
+    start_x = std::min(start_x, buf->lines[start_y].length());
+    end_x = std::min(end_x, buf->lines[end_y].length());
+    if (start_y < end_y || end_x > start_x) {
+        record(start_y, start_x, clip_range(start_y, start_x, end_y, end_x), nullptr);
+        erase_range(start_y, start_x, end_y, end_x);
+    }
+    buf->x = start_x;
+    buf->y = start_y;
+}
+
+// Keys in normal and insert mode go through the keymap, which may need more
+// than one key to decide: a key that starts a longer binding waits for the
+// next one, or for the key timeout, before it is taken on its own. The
+// prompts and the register name after '"' read keys as they come.
+void Shard::input(int c){
+    if (pending_keys.empty() && direct_input(c)) {
+        return;
+    }
+    pending_keys.push_back(normalize_key(c));
+    pending_since = std::chrono::steady_clock::now();
+    decode_keys(false);
+}
+
+bool Shard::direct_input(int c){
+    switch (mode) {
+        case '/':
+            search_input(c);
+            return true;
+        case ':':
+            command_input(c);
+            return true;
+        case 'r':
+            recovery_input(c);
+            return true;
+        case 'p':
+            finder_input(c);
+            return true;
+        case 'n':
+            if (prefix == '"') {
+                prefix = 0;
+                select_register(c);
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Runs the longest bound sequence at the front of the pending keys, or
+// types the first key when none is bound, until the keys left could still
+// grow into a longer binding. Each step looks in the keymap of the mode it
+// is in, as the action before may have switched it.
+void Shard::decode_keys(bool timed_out){
+    while (!pending_keys.empty() && mode != 'q') {
+        int c = pending_keys.front();
+        if (direct_input(c)) {
+            pending_keys.erase(pending_keys.begin());
+            continue;
+        }
+        size_t bound = 0;
+        Action action = ACTION_NONE;
+        bool longer = false;
+        for (size_t count = 1; count <= pending_keys.size(); ++count) {
+            Action found_action;
+            unsigned found = keymap.lookup(mode, pending_keys.data(), count, found_action);
+            if (found & Keymap::BOUND) {
+                bound = count;
+                action = found_action;
+            }
+            if (!(found & Keymap::PREFIX)) {
+                break;
+            }
+            longer = count == pending_keys.size();
+        }
+        if (longer && !timed_out) {
+            return;
+        }
+        if (bound > 0) {
+            pending_keys.erase(pending_keys.begin(), pending_keys.begin() + static_cast<long>(bound));
+            (this->*actions[action])();
+        } else {
+            pending_keys.erase(pending_keys.begin());
+            type_key(c);
+        }
+    }
+    pending_keys.clear();
+}
+
+// How long the pending keys may still wait for the rest of a sequence. An
+// escape that starts one waits only briefly, so leaving insert mode feels
+// instant on a local terminal. Over a slow link the rest of an arrow or alt
+// key can arrive later than that and split into Esc and stray keys;
+// ":set esctimeout=" raises the wait there.
+int Shard::key_wait() const {
+    int timeout = pending_keys.front() == 27 ? escape_timeout : key_timeout;
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - pending_since);
+    return std::max(0, timeout - static_cast<int>(waited.count()));
+}
+
+// A key no binding took: text in insert mode, nothing in normal mode.
+void Shard::type_key(int c){
+    if (mode != 'i') {
+        return;
+    }
+    if (!((c >= 32 && c <= 126) || (c >= 0xC0 && c <= 0xF7))) {
+        buf->selecting = false;
+        return;
+    }
+    if (buf->select_coords.start.y != -1) {
+        delete_selected_text();
+        clear_selection();
+        buf->selecting = false;
+    }
+
+    // A multibyte character arrives one byte per key.
+    std::string text(1, static_cast<char>(c));
+    for (size_t i = 1; i < utf8_sequence(static_cast<unsigned char>(c)); ++i) {
+        int next;
+        if (!pending_keys.empty()) {
+            next = pending_keys.front();
+            pending_keys.erase(pending_keys.begin());
+        } else {
+            next = term->read_key(50);
+        }
+        if (next < 0x80 || next > 0xBF) {
+            // not part of this character: it is the next key
+            if (next != ERR) {
+                pending_keys.insert(pending_keys.begin(), next);
+            }
+            break;
+        }
+        text += static_cast<char>(next);
+    }
+    if (buf->y >= buf->lines.size()) {
+        return;
+    }
+    // an opening bracket comes with its closing one, the cursor between them
+    if (text == "(" || text == "[" || text == "{") {
+        std::string pair = text + (text == "(" ? ")" : text == "[" ? "]" : "}");
+        record(buf->y, buf->x, "", pair);
+        m_edit(buf->y, buf->x, 0).insert(buf->x, pair);
+        ++buf->x;
+        return;
+    }
+    record(buf->y, buf->x, "", text);
+    m_edit(buf->y, buf->x, 0).insert(buf->x, text);
+    buf->x += text.length();
+}
+
+// In the order of Action.
+void (Shard::* const Shard::actions[ACTION_COUNT])() = {
+    nullptr,
+    &Shard::quit,
+    &Shard::insert_mode,
+    &Shard::normal_mode,
+    &Shard::save,
+    &Shard::move_up,
+    &Shard::move_down,
+    &Shard::move_left,
+    &Shard::move_right,
+    &Shard::move_page_down,
+    &Shard::move_page_up,
+    &Shard::move_half_page_down,
+    &Shard::move_half_page_up,
+    &Shard::move_top,
+    &Shard::move_bottom,
+    &Shard::toggle_follow,
+    &Shard::start_register,
+    &Shard::start_search,
+    &Shard::next_match,
+    &Shard::previous_match,
+    &Shard::start_command,
+    &Shard::toggle_hud,
+    &Shard::undo,
+    &Shard::redo,
+    &Shard::open_finder,
+    &Shard::open_hit,
+    &Shard::select_line_up,
+    &Shard::select_line_down,
+    &Shard::select_left,
+    &Shard::select_right,
+    &Shard::cut,
+    &Shard::copy,
+    &Shard::paste_at_cursor,
+    &Shard::paste_before_line,
+    &Shard::paste_after_line,
+    &Shard::backspace,
+    &Shard::newline,
+    &Shard::indent,
+};
+
+// Refuses while any file buffer has edits that are not saved, naming them;
+// ":q!" quits anyway and drops their journals.
+void Shard::quit(){
+    if (saves_pending()) {
+        status = " ERROR: Save in progress ";
+        color_pair = 5;
+        return;
+    }
+    std::string unsaved;
+    for (const auto& buffer : buffers) {
+        if (!buffer->scratch && buffer->modified()) {
+            unsaved += (unsaved.empty() ? "" : ", ") + buffer->filename;
+        }
+    }
+    if (!unsaved.empty()) {
+        status = " ERROR: No write since last change: " + unsaved + " (:q! quits anyway) ";
+        color_pair = 5;
+        return;
+    }
+    mode = 'q';
+}
+
+void Shard::insert_mode(){
+    mode = 'i';
+}
+
+void Shard::normal_mode(){
+    mode = 'n';
+    buf->history.seal();
+    if (highlighting) {
+        highlighting = false;
+        mark_all();
+    }
+    clear_selection();
+    buf->selecting = false;
+}
+
+// Moving the cursor ends the undo step being typed and drops a selection
+// that is not being extended.
+void Shard::moved(){
+    buf->history.seal();
+    if (!buf->selecting) {
+        clear_selection();
+    }
+}
+
+void Shard::move_up(){
+    up();
+    moved();
+}
+
+void Shard::move_down(){
+    down();
+    moved();
+}
+
+void Shard::move_left(){
+    left();
+    moved();
+}
+
+void Shard::move_right(){
+    right();
+    moved();
+}
+
+void Shard::move_page_down(){
+    page_down(term->rows() - 1);
+    moved();
+}
+
+void Shard::move_page_up(){
+    page_up(term->rows() - 1);
+    moved();
+}
+
+void Shard::move_half_page_down(){
+    page_down((term->rows() - 1) / 2);
+    moved();
+}
+
+void Shard::move_half_page_up(){
+    page_up((term->rows() - 1) / 2);
+    moved();
+}
+
+void Shard::move_top(){
+    goto_line(0);
+}
+
+void Shard::move_bottom(){
+    goto_line(SIZE_MAX - 1);
+}
+
+void Shard::toggle_follow(){
+    if (buf->following) {
+        stop_follow();
+    } else {
+        start_follow();
+    }
+}
+
+void Shard::start_register(){
+    prefix = '"';
+}
+
+void Shard::start_search(){
+    search_origin.y = static_cast<int>(buf->y);
+    search_origin.x = static_cast<int>(buf->x);
+    search_query.clear();
+    search_failed = false;
+    highlighting = true;
+    mode = '/';
+    mark_all();
+}
+
+void Shard::next_match(){
+    search_next(true);
+}
+
+void Shard::previous_match(){
+    search_next(false);
+}
+
+void Shard::start_command(){
+    command_line.clear();
+    mode = ':';
+}
+
+void Shard::toggle_hud(){
+    hud = !hud;
+    mark_rows(0, HUD_ROWS - 1);
+}
+
+// Selects whole lines, growing the selection up or shrinking it from below.
+void Shard::select_line_up(){
+    if (buf->y == 0) {
+        return;
+    }
+    if (!buf->selecting) {
+        start_selection();
+        buf->select_coords.start.x = 0;
+        buf->select_coords.end.x = buf->lines[buf->y].length();
+    }
+    up();
+    if (buf->y < static_cast<size_t>(buf->select_coords.start.y)) {
+        buf->select_coords.start.y = static_cast<int>(buf->y);
+        buf->select_coords.start.x = 0;
+    } else {
+        buf->select_coords.end.y = static_cast<int>(buf->y);
+        buf->select_coords.end.x = buf->lines[buf->y].length();
+    }
+    if (buf->y < buf->scroll_offset) {
+        --buf->scroll_offset;
+    }
+}
+
+void Shard::select_line_down(){
+    buf->lines.reach(buf->y + 2);
+    if (buf->y >= buf->lines.size() - 1) {
+        return;
+    }
+    if (!buf->selecting) {
+        start_selection();
+        buf->select_coords.start.x = 0;
+        buf->select_coords.end.x = buf->lines[buf->y].length();
+    }
+    down();
+    if (buf->y > static_cast<size_t>(buf->select_coords.start.y)) {
+        buf->select_coords.end.y = static_cast<int>(buf->y);
+        buf->select_coords.end.x = buf->lines[buf->y].length();
+    } else {
+        buf->select_coords.start.y = static_cast<int>(buf->y);
+        buf->select_coords.start.x = 0;
+    }
+    size_t screen_height = term->rows() - 1;
+    if (buf->y >= buf->scroll_offset + screen_height) {
+        ++buf->scroll_offset;
+    }
+}
+
+void Shard::select_left(){
+    if (!buf->selecting) {
+        start_selection();
+    }
+    left();
+    update_selection();
+}
+
+void Shard::select_right(){
+    if (!buf->selecting) {
+        start_selection();
+    }
+    right();
+    update_selection();
+}
+
+void Shard::cut(){
+    if (buf->select_coords.start.y == -1) {
+        status = " NO SELECTION TO CUT ";
+        color_pair = 5;
+        return;
+    }
+    yank(selected_clip());
+    delete_selected_text();
+    clear_selection();
+    buf->selecting = false;
+    status = " CUT: " + std::to_string(clipboard->length()) + " chars ";
+    color_pair = 5;
+}
+
+// Copies the selection, or the cursor's line when nothing is selected.
+void Shard::copy(){
+    if (buf->select_coords.start.y != -1) {
+        yank(selected_clip());
+        if (!clipboard->empty()) {
+            status = " COPIED: " + std::to_string(clipboard->length()) + " chars ";
+            color_pair = 4;
+        } else {
+            status = " COPY FAILED ";
+            color_pair = 5;
+        }
+        clear_selection();
+        buf->selecting = false;
+    } else if (buf->y < buf->lines.size()) {
+        yank(std::make_shared<const Clip>(std::string(buf->lines[buf->y])));
+        status = " COPIED LINE: " + std::to_string(clipboard->length()) + " chars ";
+        color_pair = 4;
+    }
+}
+
+void Shard::backspace(){
+    if (buf->select_coords.start.y != -1) {
+        delete_selected_text();
+        clear_selection();
+        buf->selecting = false;
+        return;
+    }
+    if (buf->x == 0 && buf->y > 0) {
+        if (buf->y - 1 < buf->lines.size()) {
+            buf->x = buf->lines[buf->y - 1].length();
+            record(buf->y - 1, buf->x, "\n", "");
+            m_edit(buf->y - 1, buf->x, 0) += buf->lines[buf->y];
+            m_remove(static_cast<int>(buf->y));
+            --buf->y;
+        }
+    } else if (buf->x > 0 && buf->y < buf->lines.size()) {
+        size_t start = prev_grapheme(buf->lines[buf->y], buf->x);
+        record(buf->y, start, std::string(buf->lines[buf->y].substr(start, buf->x - start)), "");
+        m_edit(buf->y, start, buf->x - start).erase(start, buf->x - start);
+        buf->x = start;
+    }
+}
+
+void Shard::newline(){
+    if (buf->select_coords.start.y != -1) {
+        delete_selected_text();
+        clear_selection();
+        buf->selecting = false;
+    }
+    if (buf->y >= buf->lines.size()) {
+        return;
+    }
+    record(buf->y, buf->x, "", "\n");
+    if (buf->x < buf->lines[buf->y].length()) {
+        size_t chars_to_move = buf->lines[buf->y].length() - buf->x;
+        m_insert(std::string(buf->lines[buf->y].substr(buf->x, chars_to_move)), static_cast<int>(buf->y + 1));
+        m_edit(buf->y, buf->x, chars_to_move).erase(buf->x, chars_to_move);
+    } else {
+        m_insert("", static_cast<int>(buf->y + 1));
+    }
+    buf->x = 0;
+    down();
+}
+
+void Shard::indent(){
+    if (buf->y < buf->lines.size()) {
+        record(buf->y, buf->x, "", "  ");
+        m_edit(buf->y, buf->x, 0).insert(buf->x, 2, ' ');
+        buf->x += 2;
+    }
+}
+
+// Draws bytes [from, to) of a line on the given screen row, clipped to the
+// columns [at.left, at.right) that row shows. The first visible byte comes
+// from the layout, so a row costs at most the screen width however long the
+// line is. Tabs expand to the next tab stop and runs of ASCII go out in one
+// call. A tab or wide character straddling the left edge shows its visible
+// cells blank; a wide character that would cross the right edge is left out.
+void Shard::draw_text(int row, const ScreenRow& at, std::string_view line, size_t from, size_t to){
+    const LineLayout& layout = buf->layouts.get(at.line, line);
+    size_t left = at.left;
+    size_t right = at.right;
+    size_t start = std::max(from, layout.byte_at(left));
+    if (start >= to) {
+        return;
+    }
+    size_t column = layout.column(start);
+    if (column >= right) {
+        return;
+    }
+    if (column < left) {
+        // a tab or wide character straddles the left edge: show its visible cells blank
+        size_t next = start + (line[start] == '\t' ? 1 : utf8_sequence(static_cast<unsigned char>(line[start])));
+        next = std::min(next, line.length());
+        size_t next_column = layout.column(next);
+        size_t blank = std::min(next_column, right) - left;
+        term->place(row, 0);
+        term->put(std::string(blank, ' '));
+        frame_bytes += blank;
+        column = next_column;
+        start = next;
+    } else {
+        term->place(row, static_cast<int>(column - left));
+    }
+    size_t tab_width = buf->layouts.tab_width();
+    while (start < to && column < right) {
+        size_t end = start;
+        size_t limit = std::min(to, start + (right - column));
+        while (end < limit && line[end] != '\t' && static_cast<unsigned char>(line[end]) < 0x80) {
+            ++end;
+        }
+        if (end > start) {
+            term->put(line.substr(start, end - start));
+            frame_bytes += end - start;
+            column += end - start;
+            start = end;
+        } else if (line[start] == '\t') {
+            size_t width = std::min(tab_width - column % tab_width, right - column);
+            term->put(std::string(width, ' '));
+            frame_bytes += width;
+            column += width;
+            ++start;
+        } else {
+            uint32_t code;
+            size_t bytes = utf8_decode(line, start, code);
+            size_t width = static_cast<size_t>(char_width(code));
+            if (column + width > right) {
+                break;
+            }
+            term->put(line.substr(start, bytes));
+            frame_bytes += bytes;
+            column += width;
+            start += bytes;
+        }
+    }
+}
+
+static int token_attributes(Token token){
+    static const int attributes[TOKEN_COUNT] = {
+        0,
+        COLOR_PAIR(7) | A_BOLD,
+        COLOR_PAIR(8),
+        COLOR_PAIR(9),
+        COLOR_PAIR(10),
+        COLOR_PAIR(11),
+        COLOR_PAIR(12),
+        COLOR_PAIR(8) | A_BOLD,
+    };
+    return attributes[token];
+}
+
+// Draws bytes from..to of a line in the colors of the tokens lexed for it.
+void Shard::draw_tokens(int row, const ScreenRow& at, std::string_view line, size_t from, size_t to){
+    size_t pos = from;
+    for (const TokenSpan& span : tokens) {
+        if (span.end <= pos) {
+            continue;
+        }
+        if (span.start >= to) {
+            break;
+        }
+        size_t start = std::max(span.start, pos);
+        size_t end = std::min(span.end, to);
+        draw_text(row, at, line, pos, start);
+        int attributes = token_attributes(span.token);
+        term->attribute_on(attributes);
+        draw_text(row, at, line, start, end);
+        term->attribute_off(attributes);
+        pos = end;
+    }
+    draw_text(row, at, line, pos, to);
+}
+
+// Keeps the cursor column on screen, jumping by half a screen so that moving
+// along a long line redraws rarely.
+void Shard::scroll_columns(){
+    size_t cols = static_cast<size_t>(term->cols());
+    size_t column = column_of(buf->y, buf->x);
+    if (wrapping || (column >= buf->col_offset && column < buf->col_offset + cols)) {
+        return;
+    }
+    buf->col_offset = column < cols ? 0 : column - cols / 2;
+}
+
+// Keeps the cursor's screen row in view when wrapping. Only the rows between
+// the top of the screen and the cursor are measured, and never more than a
+// screen's worth, so lines far off screen are not wrapped.
+void Shard::scroll_wrapped(size_t height){
+    if (!wrapping) {
+        return;
+    }
+    buf->scroll_row = std::min(buf->scroll_row, parts(buf->scroll_offset) - 1);
+    size_t part = part_of(buf->y, buf->x);
+    if (buf->y < buf->scroll_offset || (buf->y == buf->scroll_offset && part < buf->scroll_row)) {
+        buf->scroll_offset = buf->y;
+        buf->scroll_row = part;
+        return;
+    }
+    size_t line = buf->scroll_offset;
+    size_t row = buf->scroll_row;
+    size_t distance = 0;
+    while ((line < buf->y || row < part) && distance < height) {
+        step_rows(line, row, 1, true);
+        ++distance;
+    }
+    if (distance < height) {
+        return;
+    }
+    line = buf->y;
+    row = part;
+    step_rows(line, row, height - 1, false);
+    buf->scroll_offset = line;
+    buf->scroll_row = row;
+}
+
+// Works out which part of which line each screen row shows this frame.
+void Shard::layout_screen(size_t height){
+    size_t cols = static_cast<size_t>(term->cols());
+    size_t line = buf->scroll_offset;
+    size_t part = wrapping ? buf->scroll_row : 0;
+    visible.clear();
+    while (visible.size() < height) {
+        ScreenRow at;
+        if (line < buf->lines.size()) {
+            at.line = line;
+            at.part = part;
+            if (wrapping) {
+                const std::vector<size_t>& starts = buf->layouts.rows(line, buf->lines[line], cols);
+                at.left = starts[part];
+                at.right = part + 1 < starts.size() ? starts[part + 1] : at.left + cols;
+                if (++part == starts.size()) {
+                    part = 0;
+                    ++line;
+                }
+            } else {
+                at.left = buf->col_offset;
+                at.right = buf->col_offset + cols;
+                ++line;
+            }
+        }
+        visible.push_back(at);
+    }
+}
+
+void Shard::place_cursor(){
+    size_t part = part_of(buf->y, buf->x);
+    for (size_t row = 0; row < visible.size(); ++row) {
+        if (visible[row].line == buf->y && visible[row].part == part) {
+            size_t column = column_of(buf->y, buf->x) - visible[row].left;
+            column = std::min(column, static_cast<size_t>(term->cols()) - 1);
+            term->place(static_cast<int>(row), static_cast<int>(column));
+            return;
+        }
+    }
+}
+
+size_t Shard::column_of(size_t row, size_t byte){
+    return row < buf->lines.size() ? buf->layouts.get(row, buf->lines[row]).column(byte) : byte;
+}
+
+// The number of screen rows a line takes: always one unless wrapping.
+size_t Shard::parts(size_t line){
+    if (!wrapping || line >= buf->lines.size()) {
+        return 1;
+    }
+    return buf->layouts.rows(line, buf->lines[line], static_cast<size_t>(term->cols())).size();
+}
+
+size_t Shard::part_of(size_t line, size_t byte){
+    if (!wrapping || line >= buf->lines.size()) {
+        return 0;
+    }
+    size_t column = column_of(line, byte);
+    const std::vector<size_t>& starts = buf->layouts.rows(line, buf->lines[line], static_cast<size_t>(term->cols()));
+    return static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), column) - starts.begin()) - 1;
+}
+
+// Moves a position by screen rows, stopping at either end of the buffer.
+void Shard::step_rows(size_t& line, size_t& part, size_t count, bool forward){
+    while (count > 0) {
+        if (forward) {
+            size_t total = parts(line);
+            if (part + 1 < total) {
+                size_t step = std::min(count, total - 1 - part);
+                part += step;
+                count -= step;
+                continue;
+            }
+            buf->lines.reach(line + 2);
+            if (line + 1 >= buf->lines.size()) {
+                return;
+            }
+            ++line;
+            part = 0;
+        } else {
+            if (part > 0) {
+                size_t step = std::min(count, part);
+                part -= step;
+                count -= step;
+                continue;
+            }
+            if (line == 0) {
+                return;
+            }
+            --line;
+            part = parts(line) - 1;
+        }
+        --count;
+    }
+}
+
+// Moves the cursor by screen rows when wrapping, keeping its column within
+// the row where the row is long enough. Paging moves the top of the screen
+// by the same number of rows.
+void Shard::move_rows(size_t count, bool forward, bool page){
+    size_t cols = static_cast<size_t>(term->cols());
+    size_t part = part_of(buf->y, buf->x);
+    size_t offset = column_of(buf->y, buf->x) - buf->layouts.rows(buf->y, buf->lines[buf->y], cols)[part];
+    if (page) {
+        step_rows(buf->scroll_offset, buf->scroll_row, count, forward);
+    }
+    step_rows(buf->y, part, count, forward);
+
+    const std::vector<size_t>& starts = buf->layouts.rows(buf->y, buf->lines[buf->y], cols);
+    size_t column = starts[part] + offset;
+    if (part + 1 < starts.size()) {
+        column = std::min(column, starts[part + 1] - 1);
+    }
+    buf->x = buf->layouts.get(buf->y, buf->lines[buf->y]).byte_at(column);
+}
+
+void Shard::mark_rows(size_t first, size_t last){
+    for (size_t row = first; row <= last && row < dirty.size(); ++row) {
+        dirty[row] = true;
+    }
+}
+
+void Shard::mark_lines(size_t first, size_t last){
+    buf->layouts.invalidate(first, last);
+    mark_drawn(first, last);
+}
+
+void Shard::mark_drawn(size_t first, size_t last){
+    for (size_t row = 0; row < drawn_rows.size() && row < dirty.size(); ++row) {
+        if (drawn_rows[row].line >= first && drawn_rows[row].line <= last) {
+            dirty[row] = true;
+        }
+    }
+}
+
+void Shard::mark_from(size_t first){
+    mark_lines(first, SIZE_MAX);
+}
+
+void Shard::mark_all(){
+    std::fill(dirty.begin(), dirty.end(), true);
+}
+
+// Marks the rows whose highlight differs between two normalized selections:
+// only the rows between the old and new start, and between the old and new
+// end, can change.
+void Shard::mark_selection(const Selection& before, const Selection& after){
+    if (before.start.y == -1 && after.start.y == -1) {
+        return;
+    }
+    if (before.start.y == -1 || after.start.y == -1) {
+        const Selection& shown = before.start.y == -1 ? after : before;
+        mark_lines(static_cast<size_t>(shown.start.y), static_cast<size_t>(shown.end.y));
+        return;
+    }
+    if (before.start.y != after.start.y || before.start.x != after.start.x) {
+        mark_lines(static_cast<size_t>(std::min(before.start.y, after.start.y)),
+                   static_cast<size_t>(std::max(before.start.y, after.start.y)));
+    }
+    if (before.end.y != after.end.y || before.end.x != after.end.x) {
+        mark_lines(static_cast<size_t>(std::min(before.end.y, after.end.y)),
+                   static_cast<size_t>(std::max(before.end.y, after.end.y)));
+    }
+}
+
+// Shifts what is already on screen with the terminal's scroll region when
+// the rows to show are the drawn ones moved up or down, so only the exposed
+// rows have to be drawn. Any other row that now shows something else is
+// marked.
+void Shard::scroll_screen(){
+    size_t screen_height = dirty.size();
+    if (drawn_rows.size() != screen_height) {
+        mark_all();
+        drawn_rows = visible;
+        return;
+    }
+
+    long shift = 0;
+    for (size_t k = 1; k < screen_height && shift == 0 && visible[0] != drawn_rows[0]; ++k) {
+        if (drawn_rows[k] == visible[0]) {
+            shift = static_cast<long>(k);
+        } else if (visible[k] == drawn_rows[0]) {
+            shift = -static_cast<long>(k);
+        }
+    }
+    int rows = static_cast<int>(shift < 0 ? -shift : shift);
+    if (shift > 0) {
+        term->scroll_rows(0, static_cast<int>(screen_height) - 1, rows);
+        std::copy(dirty.begin() + rows, dirty.end(), dirty.begin());
+        std::fill(dirty.end() - rows, dirty.end(), true);
+    } else if (shift < 0) {
+        term->scroll_rows(0, static_cast<int>(screen_height) - 1, -rows);
+        std::copy_backward(dirty.begin(), dirty.end() - rows, dirty.end());
+        std::fill(dirty.begin(), dirty.begin() + rows, true);
+    }
+    for (size_t row = 0; row < screen_height; ++row) {
+        long drawn = static_cast<long>(row) + shift;
+        if (drawn < 0 || drawn >= static_cast<long>(screen_height) || drawn_rows[static_cast<size_t>(drawn)] != visible[row]) {
+            dirty[row] = true;
+        }
+    }
+    drawn_rows = visible;
+}
+
+void Shard::print(){
+    size_t screen_height = term->rows() - 1;
+    buf->lines.reach(buf->scroll_offset + screen_height);
+
+    if (dirty.size() != screen_height) {
+        dirty.assign(screen_height, true);
+    }
+    scroll_columns();
+    scroll_wrapped(screen_height);
+    layout_screen(screen_height);
+    scroll_screen();
+    if (buf->syntax.language() != Language::NONE) {
+        // an edit can change how the lines after it lex, e.g. by opening a comment
+        size_t bottom = 0;
+        for (const ScreenRow& at : visible) {
+            bottom = at.line != SIZE_MAX ? at.line : bottom;
+        }
+        buf->syntax.state_before(bottom + 1, buf->lines);
+        size_t first, last;
+        if (buf->syntax.restyled(first, last)) {
+            mark_lines(first, last);
+        }
+    }
+    if (buf->lines.size() != drawn_lines) {
+        mark_from(std::min(buf->lines.size(), drawn_lines));
+        drawn_lines = buf->lines.size();
+    }
+
+    Selection shown;
+    if (buf->select_coords.start.y != -1 && buf->selecting) {
+        shown = buf->select_coords;
+        if (shown.start.y > shown.end.y || (shown.start.y == shown.end.y && shown.start.x > shown.end.x)) {
+            std::swap(shown.start, shown.end);
+        }
+    }
+    mark_selection(drawn_selection, shown);
+    drawn_selection = shown;
+    Coords start = shown.start;
+    Coords end = shown.end;
+
+    frame_rows = 0;
+    frame_bytes = 0;
+    for (size_t i {}; i < screen_height; ++i){
+        if (!dirty[i]) {
+            continue;
+        }
+        dirty[i] = false;
+        ++frame_rows;
+        const ScreenRow& at = visible[i];
+        int row = static_cast<int>(i);
+        // cleared first: a row drawn to the last column leaves the cursor on the next one
+        term->place(row, 0);
+        term->clear_line();
+        if (at.line >= buf->lines.size()){
+            continue;
+        }
+        size_t line_y = at.line;
+        std::string_view current_line = buf->lines[line_y];
+        tokens.clear();
+        if (buf->syntax.language() != Language::NONE) {
+            // only as far as this row reaches; the state it starts in is cached
+            size_t limit = buf->layouts.get(line_y, current_line).byte_at(at.right) + 1;
+            lex_line(buf->syntax.language(), buf->syntax.state_before(line_y, buf->lines), current_line, limit, &tokens);
+        }
+
+        if (start.y != -1 &&
+            line_y >= static_cast<size_t>(start.y) && 
+            line_y <= static_cast<size_t>(end.y)) {
+
+            size_t sel_start = (line_y == static_cast<size_t>(start.y)) ? start.x : 0;
+            size_t sel_end = (line_y == static_cast<size_t>(end.y)) ? end.x : current_line.length();
+
+            sel_end = std::min(sel_end, current_line.length());
+            sel_start = std::min(sel_start, current_line.length());
+
+            draw_tokens(row, at, current_line, 0, sel_start);
+            if (sel_end > sel_start) {
+                term->attribute_on(A_REVERSE);
+                draw_text(row, at, current_line, sel_start, sel_end);
+                term->attribute_off(A_REVERSE);
+            }
+            draw_tokens(row, at, current_line, sel_end, current_line.length());
+        } else {
+            draw_tokens(row, at, current_line, 0, current_line.length());
+        }
+        highlight_matches(row, at, current_line);
+    }
+    	
+    place_cursor();
+}
+
+// Hands out a line to change in place; from and removed say which bytes
+// the change replaces, so the line's layout is patched rather than rebuilt.
+std::string& Shard::m_edit(size_t number, size_t from, size_t removed){
+    buf->layouts.edited(number, from, removed);
+    mark_drawn(number, number);
+    buf->syntax.changed(number);
+    return buf->lines.edit(number);
+}
+
+// Overlays rolling frame timings and buffer size in the top right corner. The
+// rows underneath are marked dirty so the next frame restores them.
+void Shard::draw_hud(){
+    static const char* names[PHASE_COUNT] = {"input", "update", "print", "status", "total"};
+    std::vector<std::string> rows;
+    char text[128];
+    snprintf(text, sizeof(text), " %-8s %9s %9s %9s  us ", "frames", "p50", "p99", "max");
+    rows.push_back(text);
+    for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+        Phase p = static_cast<Phase>(phase);
+        snprintf(text, sizeof(text), " %-8s %9.1f %9.1f %9.1f     ", names[phase],
+                 latency.percentile(p, 0.5), latency.percentile(p, 0.99), latency.max(p));
+        rows.push_back(text);
+    }
+    // measuring walks every piece, so it is only redone every so often
+    auto now = std::chrono::steady_clock::now();
+    if (usage_buffer != buf || now - usage_measured >= std::chrono::milliseconds(HUD_USAGE_MS)) {
+        buf->lines.usage(usage_heap, usage_mapped);
+        usage_buffer = buf;
+        usage_measured = now;
+    }
+    snprintf(text, sizeof(text), " %zu lines %s heap %s map %s undo", buf->lines.size(),
+             megabytes(static_cast<double>(usage_heap)).c_str(), megabytes(static_cast<double>(usage_mapped)).c_str(),
+             megabytes(static_cast<double>(buf->history.footprint())).c_str());
+    rows.push_back(text);
+
+    int col = std::max(0, term->cols() - HUD_COLS);
+    size_t width = static_cast<size_t>(std::min(HUD_COLS, term->cols()));
+    term->attribute_on(A_REVERSE);
+    for (int row = 0; row < HUD_ROWS && row < static_cast<int>(dirty.size()); ++row) {
+        std::string line = rows[static_cast<size_t>(row)];
+        line.resize(width, ' ');
+        term->place(row, col);
+        term->put(line);
+    }
+    term->attribute_off(A_REVERSE);
+    mark_rows(0, HUD_ROWS - 1);
+}
+
+void Shard::highlight_matches(int row, const ScreenRow& at, std::string_view line){
+    if (!highlighting || search_query.empty()) {
+        return;
+    }
+    // Only matches that overlap the visible columns are searched for.
+    const LineLayout& layout = buf->layouts.get(at.line, line);
+    size_t overlap = search_query.length() - 1;
+    size_t first = layout.byte_at(at.left);
+    size_t last = std::min(line.length(), layout.byte_at(at.right) + overlap);
+    first = first > overlap ? first - overlap : 0;
+    const char* begin = line.data();
+    const char* end = begin + last;
+    term->attribute_on(COLOR_PAIR(6));
+    for (const char* hit = find_text(begin + first, end, search_query); hit; hit = find_text(hit + search_query.length(), end, search_query)) {
+        size_t byte = static_cast<size_t>(hit - begin);
+        draw_text(row, at, line, byte, byte + search_query.length());
+    }
+    term->attribute_off(COLOR_PAIR(6));
+}
+
+static void locate(size_t first, std::string_view text, const char* hit, size_t& row, size_t& col){
+    row = first + static_cast<size_t>(std::count(text.data(), hit, '\n'));
+    const void* line_break = memrchr(text.data(), '\n', static_cast<size_t>(hit - text.data()));
+    const char* line_start = line_break ? static_cast<const char*>(line_break) + 1 : text.data();
+    col = static_cast<size_t>(hit - line_start);
+}
+
+// Finds the first match at or after (row, col), wrapping around to the top
+// of the buffer. The scan runs over whole spans of stored text, so lines are
+// never looked up one at a time.
+bool Shard::search_forward(size_t row, size_t col, size_t& match_row, size_t& match_col){
+    bool wrapped = false;
+    bool found = false;
+    auto scan = [&](size_t first, std::string_view text){
+        if (wrapped && first > row) return true;
+        size_t skip = (!wrapped && first == row) ? std::min(col, buf->lines[row].length()) : 0;
+        const char* hit = find_text(text.data() + skip, text.data() + text.length(), search_query);
+        if (!hit) return false;
+        locate(first, text, hit, match_row, match_col);
+        found = !wrapped || match_row < row || (match_row == row && match_col < col);
+        return true;
+    };
+    buf->lines.each_span(row, scan);
+    if (!found) {
+        wrapped = true;
+        buf->lines.each_span(0, scan);
+    }
+    return found;
+}
+
+// Finds the last match that starts before (row, col), wrapping around to the
+// bottom of the buffer.
+bool Shard::search_backward(size_t row, size_t col, size_t& match_row, size_t& match_col){
+    bool wrapped = false;
+    bool found = false;
+    bool origin_span = true;
+    auto scan = [&](size_t first, std::string_view text){
+        const char* begin = text.data();
+        const char* end = begin + text.length();
+        const char* limit = end;
+        if (origin_span) {
+            origin_span = false;
+            std::string_view current = buf->lines[row];
+            limit = current.data() + std::min(col, current.length());
+            end = std::min(end, limit + search_query.length() - 1);
+        }
+        // trimming the end leaves only matches that start before the limit
+        const char* last = find_text_last(begin, end, search_query);
+        if (!last || last >= limit) return false;
+        locate(first, text, last, match_row, match_col);
+        found = !wrapped || match_row > row || (match_row == row && match_col >= col);
+        return true;
+    };
+    buf->lines.each_span_reverse(row, scan);
+    if (!found && buf->lines.size() > 0) {
+        wrapped = true;
+        buf->lines.each_span_reverse(buf->lines.size() - 1, scan);
+    }
+    return found;
+}
+
+void Shard::search_next(bool forward){
+    if (search_query.empty()) {
+        return;
+    }
+    if (!highlighting) {
+        highlighting = true;
+        mark_all();
+    }
+    size_t match_row, match_col;
+    bool found = forward ? search_forward(buf->y, buf->x + 1, match_row, match_col)
+                         : search_backward(buf->y, buf->x, match_row, match_col);
+    if (found) {
+        buf->x = match_col;
+        goto_line(match_row);
+    }
+}
+
+void Shard::search_input(int c){
+    switch (c) {
+        case 27:
+            buf->x = static_cast<size_t>(search_origin.x);
+            goto_line(static_cast<size_t>(search_origin.y));
+            highlighting = false;
+            mode = 'n';
+            mark_all();
+            return;
+        case KEY_ENTER:
+        case 10:
+            mode = 'n';
+            return;
+        case 127:
+        case KEY_BACKSPACE:
+            if (search_query.empty()) {
+                return;
+            }
+            search_query.pop_back();
+            break;
+        default:
+            if (c < 32 || c > 255 || c == 127) {
+                return;
+            }
+            search_query += static_cast<char>(c);
+            break;
+    }
+    mark_all();
+
+    size_t match_row, match_col;
+    search_failed = false;
+    buf->x = static_cast<size_t>(search_origin.x);
+    if (search_query.empty()) {
+        goto_line(static_cast<size_t>(search_origin.y));
+    } else if (search_forward(static_cast<size_t>(search_origin.y), buf->x, match_row, match_col)) {
+        buf->x = match_col;
+        goto_line(match_row);
+    } else {
+        search_failed = true;
+        goto_line(static_cast<size_t>(search_origin.y));
+    }
+}
+
+void Shard::command_input(int c){
+    switch (c) {
+        case 27:
+            mode = 'n';
+            return;
+        case KEY_ENTER:
+        case 10:
+            mode = 'n';
+            run_command(command_line);
+            return;
+        case 127:
+        case KEY_BACKSPACE:
+            if (command_line.empty()) {
+                mode = 'n';
+                return;
+            }
+            command_line.pop_back();
+            return;
+        default:
+            if (c < 32 || c > 255 || c == 127) {
+                return;
+            }
+            command_line += static_cast<char>(c);
+            return;
+    }
+}
+
+// Splits s/pattern/replacement/flags at unescaped delimiters; any character
+// after the 's' can be the delimiter, and "\<delimiter>" stands for itself.
+static std::vector<std::string> split_command(const std::string& command, char delimiter){
+    std::vector<std::string> fields(1);
+    for (size_t i = 0; i < command.length(); ++i) {
+        if (command[i] == '\\' && i + 1 < command.length() && command[i + 1] == delimiter) {
+            fields.back() += delimiter;
+            ++i;
+        } else if (command[i] == delimiter) {
+            fields.emplace_back();
+        } else {
+            fields.back() += command[i];
+        }
+    }
+    return fields;
+}
+
+void Shard::run_command(const std::string& command){
+    std::string text = command;
+    bool whole = !text.empty() && text[0] == '%';
+    if (whole) {
+        text.erase(0, 1);
+    }
+    if (text.length() > 1 && text[0] == 's' && !isalnum(static_cast<unsigned char>(text[1]))) {
+        std::vector<std::string> fields = split_command(text.substr(2), text[1]);
+        if (fields[0].empty()) {
+            status = " ERROR: Empty pattern ";
+            color_pair = 5;
+            return;
+        }
+        std::string format = fields.size() > 1 ? fields[1] : "";
+        bool icase = fields.size() > 2 && fields[2].find('i') != std::string::npos;
+        bool global = fields.size() > 2 && fields[2].find('g') != std::string::npos;
+        replace_matches(fields[0], format, icase, global, whole);
+        return;
+    }
+    if (text == "w") {
+        save();
+        return;
+    }
+    if (text == "q") {
+        quit();
+        return;
+    }
+    if (text == "q!") {
+        discarding = true;
+        mode = 'q';
+        return;
+    }
+    if (text == "bn" || text == "bp") {
+        size_t step = text == "bn" ? 1 : buffers.size() - 1;
+        switch_buffer((current + step) % buffers.size());
+        return;
+    }
+    if (text.length() > 2 && text.compare(0, 2, "b ") == 0) {
+        size_t index = static_cast<size_t>(atoi(text.c_str() + 2));
+        if (index < 1 || index > buffers.size()) {
+            status = " ERROR: No such buffer ";
+            color_pair = 5;
+            return;
+        }
+        switch_buffer(index - 1);
+        return;
+    }
+    if (text.length() > 2 && text.compare(0, 2, "e ") == 0) {
+        switch_buffer(add_buffer(text.substr(2)));
+        return;
+    }
+    if (text.length() > 5 && text.compare(0, 5, "grep ") == 0) {
+        start_grep(text.substr(5));
+        return;
+    }
+    if (text == "ls") {
+        list_buffers();
+        return;
+    }
+    if (text == "set wrap" || text == "set nowrap") {
+        wrapping = text == "set wrap";
+        buf->col_offset = 0;
+        buf->scroll_row = 0;
+        mark_all();
+        return;
+    }
+    if (text == "set follow" || text == "set nofollow") {
+        if (text == "set follow") {
+            start_follow();
+        } else {
+            stop_follow();
+        }
+        return;
+    }
+    if (text.compare(0, 11, "set syntax=") == 0) {
+        std::string name = text.substr(11);
+        Language language = language_for("." + name);
+        if (language == Language::NONE && name != "off") {
+            status = " ERROR: Unknown syntax: " + name + " ";
+            color_pair = 5;
+            return;
+        }
+        buf->syntax.set_language(language);
+        mark_all();
+        return;
+    }
+    if (text == "set bgsave" || text == "set nobgsave") {
+        background_save = text == "set bgsave";
+        return;
+    }
+    if (text.compare(0, 12, "set journal=") == 0) {
+        int interval = atoi(text.c_str() + 12);
+        if (interval < 10 || interval > 60000) {
+            status = " ERROR: Journal interval must be 10-60000ms ";
+            color_pair = 5;
+            return;
+        }
+        bool resuming = journal_interval == 0;
+        journal_interval = static_cast<unsigned>(interval);
+        for (auto& buffer : buffers) {
+            buffer->journal.set_interval(journal_interval);
+            if (resuming) {
+                buffer->journal_failed = false;
+                resume_journal(*buffer);
+            }
+        }
+        return;
+    }
+    if (text == "set nojournal") {
+        journal_interval = 0;
+        for (auto& buffer : buffers) {
+            buffer->journal.stop(true);
+        }
+        return;
+    }
+    if (text.compare(0, 13, "set tabwidth=") == 0) {
+        int width = atoi(text.c_str() + 13);
+        if (width < 1 || width > 64) {
+            status = " ERROR: Tab width must be 1-64 ";
+            color_pair = 5;
+            return;
+        }
+        for (auto& buffer : buffers) {
+            buffer->layouts.set_tab_width(static_cast<size_t>(width));
+        }
+        mark_all();
+        return;
+    }
+    if (text.compare(0, 15, "set esctimeout=") == 0) {
+        int timeout = atoi(text.c_str() + 15);
+        if (timeout < 0 || timeout > 1000) {
+            status = " ERROR: Escape timeout must be 0-1000ms ";
+            color_pair = 5;
+            return;
+        }
+        escape_timeout = timeout;
+        term->set_escape_timeout(escape_timeout);
+        return;
+    }
+    if (text.compare(0, 15, "set keytimeout=") == 0) {
+        int timeout = atoi(text.c_str() + 15);
+        if (timeout < 10 || timeout > 10000) {
+            status = " ERROR: Key timeout must be 10-10000ms ";
+            color_pair = 5;
+            return;
+        }
+        key_timeout = timeout;
+        return;
+    }
+    if (text.compare(0, 4, "map ") == 0 || text.compare(0, 6, "unmap ") == 0) {
+        map_command(text);
+        return;
+    }
+    if (!text.empty()) {
+        status = " ERROR: Unknown command: " + command + " ";
+        color_pair = 5;
+    }
+}
+
+// "map MODE KEYS ACTION" binds a key sequence in normal or insert mode and
+// "unmap MODE KEYS" drops one, e.g. "map normal <C-s> save".
+void Shard::map_command(const std::string& text){
+    std::vector<std::string> words;
+    for (size_t i = 0; i < text.length(); ) {
+        size_t end = text.find(' ', i);
+        end = end == std::string::npos ? text.length() : end;
+        if (end > i) {
+            words.push_back(text.substr(i, end - i));
+        }
+        i = end + 1;
+    }
+    bool binding = words[0] == "map";
+    if (words.size() != (binding ? 4u : 3u)) {
+        status = binding ? " ERROR: Usage: map MODE KEYS ACTION " : " ERROR: Usage: unmap MODE KEYS ";
+        color_pair = 5;
+        return;
+    }
+    char keymap_mode = mode_named(words[1]);
+    std::vector<int> keys;
+    if (!keymap_mode) {
+        status = " ERROR: Unknown mode: " + words[1] + " ";
+    } else if (!parse_keys(words[2], keys)) {
+        status = " ERROR: Unknown keys: " + words[2] + " ";
+    } else if (!binding) {
+        if (keymap.unbind(keymap_mode, keys)) {
+            return;
+        }
+        status = " ERROR: Not mapped: " + words[2] + " ";
+    } else if (keymap.bind(keymap_mode, keys, action_named(words[3]))) {
+        return;
+    } else {
+        status = " ERROR: Unknown action: " + words[3] + " ";
+    }
+    color_pair = 5;
+}
+
+// The config file holds commands run at startup as if typed after ':', one
+// per line, such as maps and sets; lines starting with '#' are comments.
+// It is $SHARD_CONFIG if set, else shard/config in the user's config
+// directory. The first line that fails is reported by its number.
+void Shard::load_config(){
+    std::string path;
+    if (const char* file = getenv("SHARD_CONFIG")) {
+        path = file;
+    } else if (const char* xdg = getenv("XDG_CONFIG_HOME"); xdg && *xdg) {
+        path = std::string(xdg) + "/shard/config";
+    } else if (const char* home = getenv("HOME"); home && *home) {
+        path = std::string(home) + "/.config/shard/config";
+    }
+    std::ifstream in(path);
+    if (path.empty() || !in) {
+        return;
+    }
+    std::string shown = status;
+    int shown_color = color_pair;
+    std::string failed;
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        size_t start = line.find_first_not_of(" \t");
+        size_t end = line.find_last_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        status.clear();
+        run_command(line.substr(start, end - start + 1));
+        if (failed.empty() && status.compare(0, 8, " ERROR: ") == 0) {
+            failed = " ERROR: config:" + std::to_string(number) + ": " + status.substr(8);
+        }
+    }
+    status = failed.empty() ? shown : failed;
+    color_pair = failed.empty() ? shown_color : 5;
+}
+
+// Replaces the first match of the pattern on each line, or every match
+// with the g flag, on the cursor's line or with % in the whole buffer.
+// Matching runs on all cores over a read-only view of the buffer; each
+// changed block of lines is then swapped in as one piece and the whole
+// change is one undo step.
+void Shard::replace_matches(const std::string& pattern, const std::string& format, bool icase, bool global, bool whole){
+    auto started = std::chrono::steady_clock::now();
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (icase) {
+        flags |= std::regex::icase;
+    }
+
+    unsigned threads = whole ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+    std::vector<Substitution> blocks;
+    try {
+        std::regex compiled(pattern, flags);
+        if (whole) {
+            buf->lines.wait();
+            blocks = substitute(buf->lines, 0, buf->lines.size(), compiled, format, global, threads);
+        } else if (buf->y < buf->lines.size()) {
+            blocks = substitute(buf->lines, buf->y, 1, compiled, format, global, threads);
+        }
+    } catch (const std::regex_error&) {
+        status = " ERROR: Invalid pattern: " + pattern + " ";
+        color_pair = 5;
+        return;
+    }
+
+    size_t replaced = 0;
+    std::vector<Edit> edits;
+    for (Substitution& block : blocks) {
+        replaced += block.replaced;
+        erase_lines(block.first, block.count);
+        insert_lines(block.first, std::move(block.text));
+        std::move(block.edits.begin(), block.edits.end(), std::back_inserter(edits));
+    }
+    for (const Edit& edit : edits) {
+        journal_edit(edit, true);
+    }
+    buf->history.record_group(std::move(edits));
+    clear_selection();
+    buf->selecting = false;
+    buf->layouts.clear();
+    mark_all();
+    goto_line(buf->y);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    status = " REPLACED: " + std::to_string(replaced) + " in " + std::to_string(elapsed.count()) + "ms (" +
+             std::to_string(threads) + " threads) ";
+    color_pair = replaced > 0 ? 4 : 5;
+}
+
+void Shard::m_remove(int number){
+    if (number >= 0 && static_cast<size_t>(number) < buf->lines.size()) {
+        mark_from(static_cast<size_t>(number));
+        erase_lines(static_cast<size_t>(number), 1);
+    }
+}
+
+void Shard::m_insert(std::string line, int number){
+    size_t insert_pos = (number >= 0 && static_cast<size_t>(number) <= buf->lines.size()) ? static_cast<size_t>(number) : buf->lines.size();
+    mark_from(insert_pos);
+    insert_lines(insert_pos, std::move(line));
+}
+
+// Adds text, which may hold several lines, after the last line as one piece.
+void Shard::m_append(std::string text){
+    buf->lines.push_back(std::move(text));
+}
+
+// Every change to the number of lines goes through these, so the lexer
+// state cache can shift along with the buffer.
+void Shard::insert_lines(size_t at, std::string text){
+    size_t before = buf->lines.size();
+    buf->lines.insert(at, std::move(text));
+    buf->syntax.inserted(at, buf->lines.size() - before);
+}
+
+void Shard::insert_lines(size_t at, const std::vector<Slice>& slices){
+    size_t before = buf->lines.size();
+    buf->lines.insert(at, slices);
+    buf->syntax.inserted(at, buf->lines.size() - before);
+}
+
+void Shard::erase_lines(size_t at, size_t count){
+    buf->lines.erase(at, count);
+    buf->syntax.erased(at, count);
+}
+
+void Shard::up(){
+    if (wrapping) {
+        move_rows(1, false, false);
+        return;
+    }
+    size_t column = column_of(buf->y, buf->x);
+    if(buf->y > 0){
+        --buf->y;
+    }
+    	
+    if (buf->y < buf->scroll_offset) {
+             --buf->scroll_offset;
+    }
+
+    if (buf->y < buf->lines.size()){
+        buf->x = buf->layouts.get(buf->y, buf->lines[buf->y]).byte_at(column);
+    }
+}
+
+void Shard::right(){
+    if (buf->y < buf->lines.size() && buf->x < buf->lines[buf->y].length()){
+        buf->x = next_grapheme(buf->lines[buf->y], buf->x);
+    }
+}
+
+void Shard::left(){
+    if(buf->x > 0 && buf->y < buf->lines.size()){
+        buf->x = prev_grapheme(buf->lines[buf->y], buf->x);
+    }
+}
+
+void Shard::down(){
+    size_t screen_height = term->rows() - 1;
+    if (!buf->lines.reach(buf->y + 2) && buf->lines.loading()) {
+        pending_line = buf->y + 1;
+    }
+    if (wrapping) {
+        move_rows(1, true, false);
+        return;
+    }
+    size_t column = column_of(buf->y, buf->x);
+
+    if(buf->y < buf->lines.size() - 1){
+        ++buf->y;
+    }
+
+    if (buf->y >= buf->scroll_offset + screen_height) {
+               ++buf->scroll_offset;
+    }
+
+    if(buf->y < buf->lines.size()){
+        buf->x = buf->layouts.get(buf->y, buf->lines[buf->y]).byte_at(column);
+    }
+}
+
+void Shard::page_down(size_t rows){
+    if (wrapping) {
+        move_rows(rows, true, true);
+        return;
+    }
+    size_t offset = buf->scroll_offset + rows;
+    goto_line(buf->y + rows);
+    buf->scroll_offset = std::min(offset, buf->y);
+}
+
+void Shard::page_up(size_t rows){
+    if (wrapping) {
+        move_rows(rows, false, true);
+        return;
+    }
+    buf->scroll_offset -= std::min(rows, buf->scroll_offset);
+    goto_line(buf->y - std::min(rows, buf->y));
+}
+
+void Shard::goto_line(size_t line){
+    buf->lines.reach(line + 1);
+    pending_line = SIZE_MAX;
+    if (line >= buf->lines.size()) {
+        if (buf->lines.loading()) {
+            pending_line = line;
+        }
+        line = buf->lines.size() - 1;
+    }
+    buf->y = line;
+
+    // when wrapping, print() brings the cursor's row into view
+    size_t screen_height = term->rows() - 1;
+    if (!wrapping) {
+        if (buf->y < buf->scroll_offset) {
+            buf->scroll_offset = buf->y;
+        } else if (buf->y >= buf->scroll_offset + screen_height) {
+            buf->scroll_offset = buf->y - screen_height + 1;
+        }
+    }
+
+    if (buf->x > buf->lines[buf->y].length()) {
+        buf->x = buf->lines[buf->y].length();
+    }
+}
+
+std::shared_ptr<const Clip> Shard::selected_clip(){
+    if (buf->select_coords.start.y == -1) return std::make_shared<const Clip>();
+    Coords start = buf->select_coords.start;
+    Coords end = buf->select_coords.end;
+    
+    if (start.y > end.y || (start.y == end.y && start.x > end.x)) {
+        std::swap(start, end);
+    }
+
+    size_t start_y = static_cast<size_t>(start.y);
+    size_t end_y = static_cast<size_t>(end.y);
+    if (start_y >= buf->lines.size() || end_y >= buf->lines.size()) {
+        return std::make_shared<const Clip>();
+    }
+    size_t start_x = std::min(static_cast<size_t>(start.x), buf->lines[start_y].length());
+    size_t end_x = std::min(static_cast<size_t>(end.x), buf->lines[end_y].length());
+    if (start_y == end_y && end_x < start_x) {
+        return std::make_shared<const Clip>();
     }
-    return selected_text;
+    return clip_range(start_y, start_x, end_y, end_x);
 }
 
 void Shard::clear_selection(){
-    select_coords.start.y = -1;
-    select_coords.start.x = -1;
-    select_coords.end.y = -1;
-    select_coords.end.x = -1;
+    buf->select_coords.start.y = -1;
+    buf->select_coords.start.x = -1;
+    buf->select_coords.end.y = -1;
+    buf->select_coords.end.x = -1;
 }
@@ -3,7 +3,24 @@
 
 #include <string>
 #include <vector>
-#include <ncurses.h>
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+#include <chrono>
+#include "terminal.hpp"
+#include "buffer.hpp"
+#include "history.hpp"
+#include "save.hpp"
+#include "latency.hpp"
+#include "layout.hpp"
+#include "clip.hpp"
+#include "journal.hpp"
+#include "follow.hpp"
+#include "syntax.hpp"
+#include "grep.hpp"
+#include "finder.hpp"
+#include "keymap.hpp"
 
 struct Coords {
     int x = -1;
@@ -15,53 +32,263 @@ struct Selection {
     Coords end;
 };
 
+// What one screen row shows: a part of a line (a wrapped row, or the whole
+// line when not wrapping) between two display columns.
+struct ScreenRow {
+    size_t line = SIZE_MAX;
+    size_t part = 0;
+    size_t left = 0;
+    size_t right = 0;
+
+    bool operator==(const ScreenRow& other) const {
+        return line == other.line && part == other.part && left == other.left && right == other.right;
+    }
+    bool operator!=(const ScreenRow& other) const {
+        return !(*this == other);
+    }
+};
+
+// Everything that belongs to one open file. The editor points at one buffer
+// at a time, so switching keeps the cursor, scroll, selection and undo
+// history of each; the text is read on the buffer's first view. A scratch
+// buffer, such as the grep results, has no file behind it.
+struct Buffer {
+    std::string filename;
+    bool loaded = false;
+    TextBuffer lines;
+    size_t x = 0;
+    size_t y = 0;
+    size_t scroll_offset = 0;
+    size_t col_offset = 0;
+    size_t scroll_row = 0;
+    Selection select_coords;
+    bool selecting = false;
+    History history;
+    LayoutCache layouts;
+    SyntaxCache syntax;
+    std::unique_ptr<SaveJob> saving;
+    size_t version = 0;
+    size_t saved_version = 0;
+    size_t saving_version = 0;
+    Journal journal;
+    bool journal_failed = false;
+    std::vector<Edit> recovered;
+    Follower follower;
+    bool following = false;
+    size_t file_bytes = 0;
+    std::weak_ptr<MappedFile> file;
+    bool scratch = false;
+
+    // Every edit moves the version on; the buffer matches its file while it
+    // is the version the last save took.
+    bool modified() const {
+        return version != saved_version;
+    }
+};
+
 class Shard {
 public:
-    Shard(const std::string& file);
+    Shard(const std::string& file, std::unique_ptr<Terminal> terminal = nullptr);
+    Shard(const std::vector<std::string>& files, std::unique_ptr<Terminal> terminal = nullptr);
     ~Shard();
     void run();
+    void frame();
+    bool running() const;
 
 private:
-    size_t x, y;
+    std::unique_ptr<Terminal> term;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::unordered_map<std::string, size_t> registry;
+    Buffer* buf;
+    size_t current;
     char mode;
     std::string status;
     std::string section;
-    std::string filename;
-    std::vector<std::string> lines;
-    std::string clipboard;
+    std::shared_ptr<const Clip> clipboard;
+    std::unordered_map<char, std::shared_ptr<const Clip>> registers;
+    std::deque<std::shared_ptr<const Clip>> yanks;
+    char register_name;
     int color_pair;
-    size_t scroll_offset;
-    
-    Selection select_coords;
-    bool selecting;
+    bool wrapping;
+    size_t pending_line;
+    int prefix;
+
+    Keymap keymap;
+    std::vector<int> pending_keys;
+    std::chrono::steady_clock::time_point pending_since;
+    int escape_timeout;
+    int key_timeout;
+
+    std::string search_query;
+    Coords search_origin;
+    bool search_failed;
+    bool highlighting;
+    std::string command_line;
+    bool message;
+
+    bool background_save;
+    bool discarding;
+    unsigned journal_interval;
+
+    std::unique_ptr<GrepJob> grep;
+    size_t grep_buffer;
+
+    std::unique_ptr<FileIndex> file_index;
+    FileFinder finder;
+    std::string finder_query;
+    size_t finder_selected;
+
+    std::vector<bool> dirty;
+    std::vector<ScreenRow> visible;
+    std::vector<ScreenRow> drawn_rows;
+    size_t drawn_lines;
+    Selection drawn_selection;
+    size_t frame_rows;
+    size_t frame_bytes;
+    std::vector<TokenSpan> tokens;
+
+    LatencyLog latency;
+    bool hud;
+    std::string latency_path;
+    std::chrono::steady_clock::time_point usage_measured;
+    const Buffer* usage_buffer;
+    size_t usage_heap;
+    size_t usage_mapped;
 
     void update();
     void statusline();
     void print();
+    void draw_text(int row, const ScreenRow& at, std::string_view line, size_t from, size_t to);
+    void draw_tokens(int row, const ScreenRow& at, std::string_view line, size_t from, size_t to);
+    void scroll_columns();
+    void scroll_wrapped(size_t height);
+    void layout_screen(size_t height);
+    void place_cursor();
+    size_t column_of(size_t row, size_t byte);
+    size_t parts(size_t line);
+    size_t part_of(size_t line, size_t byte);
+    void step_rows(size_t& line, size_t& part, size_t count, bool forward);
+    void move_rows(size_t count, bool forward, bool page);
+    void highlight_matches(int row, const ScreenRow& at, std::string_view line);
+    void draw_hud();
+    void mark_rows(size_t first, size_t last);
+    void mark_lines(size_t first, size_t last);
+    void mark_drawn(size_t first, size_t last);
+    void mark_from(size_t first);
+    void mark_all();
+    void scroll_screen();
+    void mark_selection(const Selection& before, const Selection& after);
     void input(int c);
+    bool direct_input(int c);
+    void decode_keys(bool timed_out);
+    int key_wait() const;
+    void type_key(int c);
+    void load_config();
+    void map_command(const std::string& text);
+
+    static void (Shard::* const actions[ACTION_COUNT])();
+    void quit();
+    void insert_mode();
+    void normal_mode();
+    void moved();
+    void move_up();
+    void move_down();
+    void move_left();
+    void move_right();
+    void move_page_down();
+    void move_page_up();
+    void move_half_page_down();
+    void move_half_page_up();
+    void move_top();
+    void move_bottom();
+    void toggle_follow();
+    void start_register();
+    void start_search();
+    void next_match();
+    void previous_match();
+    void start_command();
+    void toggle_hud();
+    void select_line_up();
+    void select_line_down();
+    void select_left();
+    void select_right();
+    void cut();
+    void copy();
+    void backspace();
+    void newline();
+    void indent();
 
     void up();
     void right();
     void left();
     void down();
+    void page_down(size_t rows);
+    void page_up(size_t rows);
+    void goto_line(size_t line);
 
+    std::string& m_edit(size_t number, size_t from, size_t removed);
     void m_remove(int number);
-    std::string m_tabs(std::string& line);
     void m_insert(std::string line, int number);
-    void m_append(std::string& line);
+    void m_append(std::string text);
+    void insert_lines(size_t at, std::string text);
+    void insert_lines(size_t at, const std::vector<Slice>& slices);
+    void erase_lines(size_t at, size_t count);
+
+    bool search_forward(size_t row, size_t col, size_t& match_row, size_t& match_col);
+    bool search_backward(size_t row, size_t col, size_t& match_row, size_t& match_col);
+    void search_next(bool forward);
+    void search_input(int c);
+    void command_input(int c);
+    void run_command(const std::string& command);
+    void replace_matches(const std::string& pattern, const std::string& format, bool icase, bool global, bool whole);
 
+    size_t add_buffer(const std::string& file);
+    void switch_buffer(size_t index);
+    void list_buffers();
+    bool saves_pending() const;
     void open();
+    bool start_journal(Buffer& buffer);
+    void resume_journal(Buffer& buffer);
+    void journal_edit(const Edit& edit, bool forward);
+    bool fits(const Edit& edit);
+    void recovery_input(int c);
+    void recover();
     void save();
+    void start_follow();
+    void stop_follow();
+    void follow();
+    void finish_save(Buffer& buffer);
+    void start_grep(const std::string& needle);
+    void poll_grep();
+    void open_hit();
+    void open_finder();
+    void finder_input(int c);
+    void draw_finder();
     
-    std::string get_selected_text();
+    std::shared_ptr<const Clip> selected_clip();
+    std::shared_ptr<const Clip> clip_range(size_t row, size_t col, size_t end_row, size_t end_col);
     void clear_selection();
     void start_selection();
     void update_selection();
     void delete_selected_text();
 
+    void insert_text(const std::string& text);
+    void insert_at(size_t row, size_t col, const std::string& text);
+    void erase_range(size_t row, size_t col, size_t end_row, size_t end_col);
+    void record(size_t row, size_t col, std::string removed, std::string inserted);
+    void record(size_t row, size_t col, std::shared_ptr<const Clip> removed, std::shared_ptr<const Clip> inserted);
+    void insert_clip(size_t row, size_t col, const Clip& clip);
+    void apply_step(const std::vector<Edit>& edits, bool forward);
+    void apply_edit(const Edit& edit, bool forward);
+    void undo();
+    void redo();
+    void paste_bracketed();
     void paste_at_cursor();
     void paste_before_line();
     void paste_after_line();
+    void yank(std::shared_ptr<const Clip> clip);
+    std::shared_ptr<const Clip> paste_source();
+    void select_register(int c);
 };
 
 #endif
@@ -0,0 +1,591 @@
+#include "syntax.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+
+static const size_t SYNC_LINES = 1000;
+
+// States a line can end in; 0 is always "nothing open". A YAML block scalar
+// ends in its parent's indentation plus one instead.
+static const uint32_t C_COMMENT = 1;
+static const uint32_t C_STRING = 2;
+static const uint32_t SHELL_SINGLE = 1;
+static const uint32_t SHELL_DOUBLE = 2;
+
+Language language_for(const std::string& path){
+    size_t slash = path.rfind('/');
+    std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    if (name == ".bashrc" || name == ".bash_profile" || name == ".profile" || name == ".zshrc") {
+        return Language::SHELL;
+    }
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) {
+        return Language::NONE;
+    }
+    std::string ext = name.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c){ return static_cast<char>(tolower(c)); });
+    if (ext == "c" || ext == "h" || ext == "cc" || ext == "cpp" || ext == "cxx" || ext == "hpp" || ext == "hh" || ext == "hxx") {
+        return Language::C;
+    }
+    if (ext == "json") {
+        return Language::JSON;
+    }
+    if (ext == "yaml" || ext == "yml") {
+        return Language::YAML;
+    }
+    if (ext == "sh" || ext == "bash" || ext == "zsh" || ext == "ksh") {
+        return Language::SHELL;
+    }
+    return Language::NONE;
+}
+
+namespace {
+
+struct Spans {
+    std::vector<TokenSpan>* out;
+    size_t limit;
+
+    void emit(size_t start, size_t end, Token token) const {
+        if (out && start < end && start < limit) {
+            out->push_back({start, std::min(end, limit), token});
+        }
+    }
+};
+
+bool ident_start(char c){
+    return isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool ident_char(char c){
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+size_t word_end(std::string_view line, size_t pos){
+    while (pos < line.length() && ident_char(line[pos])) {
+        ++pos;
+    }
+    return pos;
+}
+
+// Scans a quoted string from just past its opening quote to just past the
+// closing one, or to the end of the line when it is left open.
+size_t quoted_end(std::string_view line, size_t pos, char quote, bool escapes, bool& closed){
+    while (pos < line.length()) {
+        char c = line[pos++];
+        if (escapes && c == '\\') {
+            ++pos;
+        } else if (c == quote) {
+            closed = true;
+            return pos;
+        }
+    }
+    closed = false;
+    return line.length();
+}
+
+bool continued(std::string_view line){
+    return !line.empty() && line.back() == '\\';
+}
+
+bool all_caps(std::string_view word){
+    bool letter = false;
+    for (char c : word) {
+        if (islower(static_cast<unsigned char>(c))) return false;
+        letter = letter || isupper(static_cast<unsigned char>(c));
+    }
+    return letter && word.length() > 1;
+}
+
+const std::unordered_set<std::string_view>& c_keywords(){
+    static const std::unordered_set<std::string_view> words = {
+        "alignas", "alignof", "asm", "auto", "break", "case", "catch", "class", "co_await", "co_return",
+        "co_yield", "concept", "const", "consteval", "constexpr", "constinit", "const_cast", "continue",
+        "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit", "export",
+        "extern", "false", "final", "for", "friend", "goto", "if", "inline", "mutable", "namespace", "new",
+        "noexcept", "nullptr", "operator", "override", "private", "protected", "public", "register",
+        "reinterpret_cast", "requires", "return", "sizeof", "static", "static_assert", "static_cast",
+        "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef", "typeid",
+        "typename", "union", "using", "virtual", "volatile", "while"};
+    return words;
+}
+
+const std::unordered_set<std::string_view>& c_types(){
+    static const std::unordered_set<std::string_view> words = {
+        "bool", "char", "char8_t", "char16_t", "char32_t", "double", "float", "int", "long", "short",
+        "signed", "unsigned", "void", "wchar_t", "size_t", "ssize_t", "ptrdiff_t", "intptr_t", "uintptr_t",
+        "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t"};
+    return words;
+}
+
+const std::unordered_set<std::string_view>& shell_keywords(){
+    static const std::unordered_set<std::string_view> words = {
+        "if", "then", "else", "elif", "fi", "for", "while", "until", "do", "done", "case", "esac", "in",
+        "function", "select", "return", "local", "export", "readonly", "declare", "break", "continue",
+        "exit", "source", "set", "unset", "shift", "trap", "eval", "exec"};
+    return words;
+}
+
+uint32_t lex_c(uint32_t state, std::string_view line, const Spans& spans){
+    size_t n = line.length();
+    size_t pos = 0;
+    bool include = false;
+    if (state == C_COMMENT) {
+        size_t close = line.find("*/");
+        if (close == std::string_view::npos) {
+            spans.emit(0, n, TOKEN_COMMENT);
+            return C_COMMENT;
+        }
+        pos = close + 2;
+        spans.emit(0, pos, TOKEN_COMMENT);
+    } else if (state == C_STRING) {
+        bool closed;
+        pos = quoted_end(line, 0, '"', true, closed);
+        spans.emit(0, pos, TOKEN_STRING);
+        if (!closed) {
+            return continued(line) ? C_STRING : 0;
+        }
+    } else {
+        size_t first = line.find_first_not_of(" \t");
+        if (first != std::string_view::npos && line[first] == '#') {
+            size_t name = line.find_first_not_of(" \t", first + 1);
+            pos = name == std::string_view::npos ? n : word_end(line, name);
+            include = name != std::string_view::npos && line.substr(name, pos - name) == "include";
+            spans.emit(first, pos, TOKEN_MACRO);
+        }
+    }
+
+    while (pos < n && pos < spans.limit) {
+        char c = line[pos];
+        char next = pos + 1 < n ? line[pos + 1] : 0;
+        if (c == '/' && next == '/') {
+            spans.emit(pos, n, TOKEN_COMMENT);
+            return 0;
+        }
+        if (c == '/' && next == '*') {
+            size_t close = line.find("*/", pos + 2);
+            if (close == std::string_view::npos) {
+                spans.emit(pos, n, TOKEN_COMMENT);
+                return C_COMMENT;
+            }
+            spans.emit(pos, close + 2, TOKEN_COMMENT);
+            pos = close + 2;
+        } else if (c == '"' || c == '\'') {
+            bool closed;
+            size_t end = quoted_end(line, pos + 1, c, true, closed);
+            spans.emit(pos, end, TOKEN_STRING);
+            if (!closed && c == '"' && continued(line)) {
+                return C_STRING;
+            }
+            pos = end;
+        } else if (include && c == '<') {
+            size_t close = line.find('>', pos);
+            size_t end = close == std::string_view::npos ? n : close + 1;
+            spans.emit(pos, end, TOKEN_STRING);
+            pos = end;
+        } else if (isdigit(static_cast<unsigned char>(c)) || (c == '.' && isdigit(static_cast<unsigned char>(next)))) {
+            size_t end = pos + 1;
+            while (end < n && (ident_char(line[end]) || line[end] == '.' || line[end] == '\'' ||
+                   ((line[end] == '+' || line[end] == '-') && strchr("eEpP", line[end - 1])))) {
+                ++end;
+            }
+            spans.emit(pos, end, TOKEN_NUMBER);
+            pos = end;
+        } else if (ident_start(c)) {
+            size_t end = word_end(line, pos);
+            std::string_view word = line.substr(pos, end - pos);
+            if (c_keywords().count(word)) {
+                spans.emit(pos, end, TOKEN_KEYWORD);
+            } else if (c_types().count(word)) {
+                spans.emit(pos, end, TOKEN_TYPE);
+            } else if (all_caps(word)) {
+                spans.emit(pos, end, TOKEN_MACRO);
+            }
+            pos = end;
+        } else {
+            ++pos;
+        }
+    }
+    return 0;
+}
+
+uint32_t lex_json(std::string_view line, const Spans& spans){
+    size_t n = line.length();
+    size_t pos = 0;
+    while (pos < n && pos < spans.limit) {
+        char c = line[pos];
+        if (c == '"') {
+            bool closed;
+            size_t end = quoted_end(line, pos + 1, '"', true, closed);
+            size_t after = line.find_first_not_of(" \t", end);
+            spans.emit(pos, end, after != std::string_view::npos && line[after] == ':' ? TOKEN_KEY : TOKEN_STRING);
+            pos = end;
+        } else if (c == '-' || isdigit(static_cast<unsigned char>(c))) {
+            size_t end = pos + 1;
+            while (end < n && (isdigit(static_cast<unsigned char>(line[end])) || strchr(".eE+-", line[end]))) {
+                ++end;
+            }
+            spans.emit(pos, end, TOKEN_NUMBER);
+            pos = end;
+        } else if (ident_start(c)) {
+            size_t end = word_end(line, pos);
+            std::string_view word = line.substr(pos, end - pos);
+            if (word == "true" || word == "false" || word == "null") {
+                spans.emit(pos, end, TOKEN_KEYWORD);
+            }
+            pos = end;
+        } else {
+            ++pos;
+        }
+    }
+    return 0;
+}
+
+Token yaml_scalar(std::string_view value){
+    static const std::unordered_set<std::string_view> words = {
+        "true", "false", "True", "False", "TRUE", "FALSE", "yes", "no", "on", "off", "null", "Null", "NULL", "~"};
+    if (words.count(value)) {
+        return TOKEN_KEYWORD;
+    }
+    size_t i = value[0] == '-' || value[0] == '+' ? 1 : 0;
+    if (i < value.length() && (isdigit(static_cast<unsigned char>(value[i])) || value[i] == '.')) {
+        for (; i < value.length(); ++i) {
+            if (!isxdigit(static_cast<unsigned char>(value[i])) && !strchr(".xXoO_+-", value[i])) {
+                return TOKEN_PLAIN;
+            }
+        }
+        return TOKEN_NUMBER;
+    }
+    return TOKEN_PLAIN;
+}
+
+uint32_t lex_yaml(uint32_t state, std::string_view line, const Spans& spans){
+    size_t n = line.length();
+    size_t indent = line.find_first_not_of(' ');
+    if (indent == std::string_view::npos) {
+        return state;
+    }
+    if (state > 0) {
+        if (indent >= state) {
+            spans.emit(indent, n, TOKEN_STRING);
+            return state;
+        }
+        state = 0;
+    }
+
+    size_t pos = indent;
+    if (line[pos] == '#') {
+        spans.emit(pos, n, TOKEN_COMMENT);
+        return 0;
+    }
+    if (line.substr(pos, 3) == "---" || line.substr(pos, 3) == "...") {
+        spans.emit(pos, pos + 3, TOKEN_KEYWORD);
+        pos += 3;
+    }
+    while (pos < n && line[pos] == '-' && (pos + 1 == n || line[pos + 1] == ' ')) {
+        spans.emit(pos, pos + 1, TOKEN_KEYWORD);
+        pos = std::min(n, line.find_first_not_of(' ', pos + 1));
+    }
+
+    size_t node = pos;
+    if (pos < n && (line[pos] == '"' || line[pos] == '\'')) {
+        bool closed;
+        size_t end = quoted_end(line, pos + 1, line[pos], line[pos] == '"', closed);
+        if (end < n && line[end] == ':' && (end + 1 == n || line[end + 1] == ' ')) {
+            spans.emit(pos, end, TOKEN_KEY);
+            pos = end + 1;
+        }
+    } else {
+        for (size_t i = pos; i < n; ++i) {
+            if (line[i] == '"' || line[i] == '\'' || (line[i] == '#' && i > 0 && line[i - 1] == ' ')) {
+                break;
+            }
+            if (line[i] == ':' && (i + 1 == n || line[i + 1] == ' ')) {
+                spans.emit(pos, i, TOKEN_KEY);
+                pos = i + 1;
+                break;
+            }
+        }
+    }
+
+    pos = std::min(n, line.find_first_not_of(' ', pos));
+    if (pos >= n) {
+        return 0;
+    }
+    char c = line[pos];
+    if (c == '#') {
+        spans.emit(pos, n, TOKEN_COMMENT);
+    } else if (c == '|' || c == '>') {
+        size_t comment = line.find(" #", pos);
+        size_t end = comment == std::string_view::npos ? n : comment;
+        spans.emit(pos, end, TOKEN_KEYWORD);
+        spans.emit(end, n, TOKEN_COMMENT);
+        return static_cast<uint32_t>(node) + 1;
+    } else if (c == '"' || c == '\'') {
+        bool closed;
+        size_t end = quoted_end(line, pos + 1, c, c == '"', closed);
+        spans.emit(pos, end, TOKEN_STRING);
+        size_t comment = line.find('#', end);
+        if (comment != std::string_view::npos) {
+            spans.emit(comment, n, TOKEN_COMMENT);
+        }
+    } else if (c == '&' || c == '*') {
+        size_t end = line.find(' ', pos);
+        spans.emit(pos, end == std::string_view::npos ? n : end, TOKEN_TYPE);
+    } else {
+        size_t comment = line.find(" #", pos);
+        size_t end = comment == std::string_view::npos ? n : comment;
+        size_t last = line.find_last_not_of(' ', end - 1);
+        std::string_view value = line.substr(pos, last + 1 - pos);
+        spans.emit(pos, last + 1, yaml_scalar(value));
+        spans.emit(end, n, TOKEN_COMMENT);
+    }
+    return 0;
+}
+
+bool shell_break(char c){
+    return c == ' ' || c == '\t' || c == ';' || c == '|' || c == '&' || c == '(' || c == ')' || c == '`';
+}
+
+uint32_t lex_shell(uint32_t state, std::string_view line, const Spans& spans){
+    size_t n = line.length();
+    size_t pos = 0;
+    if (state == SHELL_SINGLE) {
+        size_t close = line.find('\'');
+        if (close == std::string_view::npos) {
+            spans.emit(0, n, TOKEN_STRING);
+            return SHELL_SINGLE;
+        }
+        pos = close + 1;
+        spans.emit(0, pos, TOKEN_STRING);
+    } else if (state == SHELL_DOUBLE) {
+        bool closed;
+        pos = quoted_end(line, 0, '"', true, closed);
+        spans.emit(0, pos, TOKEN_STRING);
+        if (!closed) {
+            return SHELL_DOUBLE;
+        }
+    }
+
+    bool word_start = pos == 0 || shell_break(line[pos - 1]);
+    while (pos < n && pos < spans.limit) {
+        char c = line[pos];
+        if (c == '#' && word_start) {
+            spans.emit(pos, n, TOKEN_COMMENT);
+            return 0;
+        }
+        if (c == '\'') {
+            size_t close = line.find('\'', pos + 1);
+            if (close == std::string_view::npos) {
+                spans.emit(pos, n, TOKEN_STRING);
+                return SHELL_SINGLE;
+            }
+            spans.emit(pos, close + 1, TOKEN_STRING);
+            pos = close + 1;
+        } else if (c == '"') {
+            bool closed;
+            size_t end = quoted_end(line, pos + 1, '"', true, closed);
+            spans.emit(pos, end, TOKEN_STRING);
+            if (!closed) {
+                return SHELL_DOUBLE;
+            }
+            pos = end;
+        } else if (c == '$') {
+            size_t end = pos + 1;
+            if (end < n && line[end] == '{') {
+                size_t close = line.find('}', end);
+                end = close == std::string_view::npos ? n : close + 1;
+            } else if (end < n && ident_start(line[end])) {
+                end = word_end(line, end);
+            } else if (end < n && strchr("@*#?$!-0123456789(", line[end])) {
+                ++end;
+            }
+            spans.emit(pos, end, TOKEN_TYPE);
+            pos = end;
+        } else if (c == '\\') {
+            pos += 2;
+        } else if (word_start && (ident_start(c) || isdigit(static_cast<unsigned char>(c)))) {
+            size_t end = word_end(line, pos);
+            bool whole = end == n || shell_break(line[end]);
+            std::string_view word = line.substr(pos, end - pos);
+            if (whole && shell_keywords().count(word)) {
+                spans.emit(pos, end, TOKEN_KEYWORD);
+            } else if (whole && std::all_of(word.begin(), word.end(), [](char d){ return isdigit(static_cast<unsigned char>(d)) != 0; })) {
+                spans.emit(pos, end, TOKEN_NUMBER);
+            }
+            pos = end;
+        } else {
+            ++pos;
+        }
+        word_start = pos > 0 && pos <= n && shell_break(line[pos - 1]);
+    }
+    return 0;
+}
+
+}
+
+uint32_t lex_line(Language language, uint32_t state, std::string_view line, size_t limit,
+                  std::vector<TokenSpan>* spans){
+    Spans out{spans, limit};
+    switch (language) {
+        case Language::C:
+            return lex_c(state, line, out);
+        case Language::JSON:
+            return lex_json(line, out);
+        case Language::YAML:
+            return lex_yaml(state, line, out);
+        case Language::SHELL:
+            return lex_shell(state, line, out);
+        case Language::NONE:
+            break;
+    }
+    return 0;
+}
+
+SyntaxCache::SyntaxCache()
+    : lang(Language::NONE), base(0), dirty_from(SIZE_MAX), dirty_to(0), restyled_first(SIZE_MAX), restyled_last(0){}
+
+void SyntaxCache::set_language(Language language){
+    lang = language;
+    clear();
+}
+
+Language SyntaxCache::language() const {
+    return lang;
+}
+
+void SyntaxCache::clear(){
+    base = 0;
+    ends.clear();
+    dirty_from = SIZE_MAX;
+    dirty_to = 0;
+    restyled_first = SIZE_MAX;
+    restyled_last = 0;
+}
+
+// Lines first..last have new text. Lines not lexed yet need no note, nor
+// do lines above the base, which is taken to start clean whatever they say.
+// The notes, like ends, count from the base.
+void SyntaxCache::touch(size_t first, size_t last){
+    if (last < base) {
+        return;
+    }
+    first = std::max(first, base) - base;
+    last -= base;
+    if (first >= ends.size()) {
+        return;
+    }
+    if (dirty_from == SIZE_MAX) {
+        dirty_from = first;
+        dirty_to = last;
+    } else {
+        dirty_from = std::min(dirty_from, first);
+        dirty_to = std::max(dirty_to, last);
+    }
+}
+
+void SyntaxCache::changed(size_t line){
+    touch(line, line);
+}
+
+void SyntaxCache::inserted(size_t at, size_t count){
+    if (at < base) {
+        base += count;
+        return;
+    }
+    size_t from = at - base;
+    if (from >= ends.size() || count == 0) {
+        return;
+    }
+    ends.insert(ends.begin() + static_cast<std::ptrdiff_t>(from), count, 0);
+    if (dirty_from != SIZE_MAX) {
+        dirty_from += dirty_from >= from ? count : 0;
+        dirty_to += dirty_to >= from ? count : 0;
+    }
+    touch(at, at + count - 1);
+}
+
+// The line after the removed ones now follows a different line, so it is
+// lexed again even if its own text is unchanged.
+void SyntaxCache::erased(size_t at, size_t count){
+    if (at + count <= base) {
+        base -= count;
+        return;
+    }
+    if (at < base) {
+        // the lines from the old base down go too; the base moves up to at
+        count -= base - at;
+        base = at;
+    }
+    size_t from = at - base;
+    if (from >= ends.size() || count == 0) {
+        return;
+    }
+    size_t end = std::min(from + count, ends.size());
+    ends.erase(ends.begin() + static_cast<std::ptrdiff_t>(from), ends.begin() + static_cast<std::ptrdiff_t>(end));
+    auto shift = [&](size_t line){ return line < from ? line : line < from + count ? from : line - count; };
+    if (dirty_from != SIZE_MAX) {
+        dirty_from = shift(dirty_from);
+        dirty_to = shift(dirty_to);
+    }
+    touch(at, at);
+}
+
+// Hands over the lines whose start state changed since the last call, even
+// though their own text did not; their rows have to be drawn again.
+bool SyntaxCache::restyled(size_t& first, size_t& last){
+    if (restyled_first == SIZE_MAX) {
+        return false;
+    }
+    first = restyled_first;
+    last = restyled_last;
+    restyled_first = SIZE_MAX;
+    restyled_last = 0;
+    return true;
+}
+
+// The state line starts in: the end state of the line before it, lexing
+// whatever is missing or stale on the way there. A line above the base or
+// more than SYNC_LINES past the lexed ones moves the base to SYNC_LINES
+// above it.
+uint32_t SyntaxCache::state_before(size_t line, const TextBuffer& lines){
+    line = std::min(line, lines.size());
+    if (lang == Language::NONE || line == 0) {
+        return 0;
+    }
+    if (line < base || line > base + ends.size() + SYNC_LINES) {
+        clear();
+        base = line > SYNC_LINES ? line - SYNC_LINES : 0;
+        // lines still on screen may lex differently from the new base
+        restyled_first = 0;
+        restyled_last = SIZE_MAX - 1;
+    }
+    line -= base;
+    if (line == 0) {
+        return 0;
+    }
+    size_t valid = std::min(dirty_from, ends.size());
+    while (valid < line) {
+        uint32_t state = lex_line(lang, valid > 0 ? ends[valid - 1] : 0, lines[base + valid], SIZE_MAX, nullptr);
+        if (valid < ends.size()) {
+            bool settled = valid >= dirty_to && ends[valid] == state;
+            if (ends[valid] != state) {
+                restyled_first = std::min(restyled_first, base + valid + 1);
+                restyled_last = std::max(restyled_last, base + valid + 1);
+            }
+            ends[valid++] = state;
+            dirty_from = valid;
+            if (settled) {
+                valid = ends.size();
+            }
+        } else {
+            ends.push_back(state);
+            ++valid;
+        }
+        if (valid >= ends.size()) {
+            dirty_from = SIZE_MAX;
+            dirty_to = 0;
+        }
+    }
+    return ends[line - 1];
+}
@@ -0,0 +1,71 @@
+#ifndef SYNTAX_HPP
+#define SYNTAX_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "buffer.hpp"
+
+enum class Language { NONE, C, JSON, YAML, SHELL };
+
+enum Token : unsigned char {
+    TOKEN_PLAIN,
+    TOKEN_KEYWORD,
+    TOKEN_TYPE,
+    TOKEN_STRING,
+    TOKEN_NUMBER,
+    TOKEN_COMMENT,
+    TOKEN_MACRO,
+    TOKEN_KEY,
+    TOKEN_COUNT
+};
+
+struct TokenSpan {
+    size_t start;
+    size_t end;
+    Token token;
+};
+
+Language language_for(const std::string& path);
+
+// Lexes one line starting in the given state and returns the state at byte
+// limit (the end of the line for the state a following line starts in).
+// Spans, when wanted, cover the tokens up to limit; plain text is left out.
+uint32_t lex_line(Language language, uint32_t state, std::string_view line, size_t limit,
+                  std::vector<TokenSpan>* spans);
+
+// Keeps the lexer state at the end of every line lexed so far. Lines are
+// lexed lazily up to the last one asked for. After an edit the cached states
+// are kept: lexing resumes at the first changed line and the rest of the
+// cache is trusted again once a line past the last change ends in the state
+// it had before, so typing re-lexes a line or two, not the file. A line far
+// past the lexed ones, as after jumping to the end of a large file, is
+// reached by lexing from a base line a little above it instead of from the
+// top, taking that no comment or string is open at the base.
+class SyntaxCache {
+public:
+    SyntaxCache();
+
+    void set_language(Language language);
+    Language language() const;
+    uint32_t state_before(size_t line, const TextBuffer& lines);
+    void changed(size_t line);
+    void inserted(size_t at, size_t count);
+    void erased(size_t at, size_t count);
+    void clear();
+    bool restyled(size_t& first, size_t& last);
+
+private:
+    Language lang;
+    size_t base;
+    std::vector<uint32_t> ends;
+    size_t dirty_from;
+    size_t dirty_to;
+    size_t restyled_first;
+    size_t restyled_last;
+
+    void touch(size_t first, size_t last);
+};
+
+#endif
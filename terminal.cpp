@@ -0,0 +1,195 @@
+#include "terminal.hpp"
+#include <algorithm>
+#include <clocale>
+#include <csignal>
+#include <termios.h>
+#include <unistd.h>
+
+NcursesTerminal::NcursesTerminal(){
+    setlocale(LC_ALL, "");
+    initscr();
+    noecho();
+    cbreak();
+
+    // Ctrl-S and Ctrl-Q are bindings, not flow control, and Ctrl-O and Ctrl-V
+    // are not for the line discipline to take. cbreak() puts back the modes
+    // initscr() saved, so this comes after it and is saved as the program's.
+    struct termios modes;
+    tcgetattr(STDIN_FILENO, &modes);
+    modes.c_iflag &= ~(IXON | IXOFF);
+    modes.c_lflag &= ~IEXTEN;
+    tcsetattr(STDIN_FILENO, TCSANOW, &modes);
+    def_prog_mode();
+
+    keypad(stdscr, true);
+    idlok(stdscr, TRUE);
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    write(STDOUT_FILENO, "\033[?2004h", 8);
+    intrflush(stdscr, FALSE);
+    signal(SIGINT, SIG_IGN);
+
+    if (has_colors()){
+        start_color();
+        init_pair(1, COLOR_BLACK, COLOR_GREEN);
+        init_pair(2, COLOR_BLACK, COLOR_MAGENTA);
+        init_pair(3, COLOR_WHITE, COLOR_BLACK);
+        init_pair(4, COLOR_BLACK, COLOR_WHITE);
+        init_pair(5, COLOR_BLACK, COLOR_MAGENTA);
+        init_pair(6, COLOR_BLACK, COLOR_YELLOW);
+        // syntax colors, on the terminal's own background where it allows
+        short background = use_default_colors() == OK ? -1 : COLOR_BLACK;
+        init_pair(7, COLOR_YELLOW, background);
+        init_pair(8, COLOR_CYAN, background);
+        init_pair(9, COLOR_GREEN, background);
+        init_pair(10, COLOR_MAGENTA, background);
+        init_pair(11, COLOR_BLUE, background);
+        init_pair(12, COLOR_RED, background);
+    }
+    refresh();
+}
+
+NcursesTerminal::~NcursesTerminal(){
+    write(STDOUT_FILENO, "\033[?2004l", 8);
+    endwin();
+}
+
+int NcursesTerminal::rows() const {
+    return LINES;
+}
+
+int NcursesTerminal::cols() const {
+    return COLS;
+}
+
+int NcursesTerminal::read_key(int timeout_ms){
+    timeout(timeout_ms);
+    return getch();
+}
+
+void NcursesTerminal::place(int row, int col){
+    move(row, col);
+}
+
+void NcursesTerminal::put(std::string_view text){
+    addnstr(text.data(), static_cast<int>(text.length()));
+}
+
+void NcursesTerminal::clear_line(){
+    clrtoeol();
+}
+
+void NcursesTerminal::attribute_on(int attrs){
+    attron(attrs);
+}
+
+void NcursesTerminal::attribute_off(int attrs){
+    attroff(attrs);
+}
+
+// Shifts rows top..bottom by count (up when positive) with the terminal's
+// own scroll region, so the rows that stay visible are not sent again.
+void NcursesTerminal::scroll_rows(int top, int bottom, int count){
+    setscrreg(top, bottom);
+    scrollok(stdscr, TRUE);
+    scrl(count);
+    scrollok(stdscr, FALSE);
+}
+
+void NcursesTerminal::flush(){
+    refresh();
+}
+
+void NcursesTerminal::set_escape_timeout(int timeout_ms){
+    set_escdelay(timeout_ms);
+}
+
+VirtualTerminal::VirtualTerminal(int rows, int cols)
+    : height(rows), width(cols), cursor_row(0), cursor_col(0), attrs(0),
+      text(static_cast<size_t>(rows * cols), ' '), styles(static_cast<size_t>(rows * cols), 0),
+      bytes(0), flushes(0){}
+
+int VirtualTerminal::rows() const {
+    return height;
+}
+
+int VirtualTerminal::cols() const {
+    return width;
+}
+
+int VirtualTerminal::read_key(int){
+    if (keys.empty()) {
+        return ERR;
+    }
+    int key = keys.front();
+    keys.pop_front();
+    return key;
+}
+
+void VirtualTerminal::place(int row, int col){
+    cursor_row = std::max(0, std::min(row, height - 1));
+    cursor_col = std::max(0, std::min(col, width));
+}
+
+void VirtualTerminal::put(std::string_view data){
+    bytes += data.length();
+    for (char c : data) {
+        if (cursor_col >= width) {
+            break;
+        }
+        size_t cell = static_cast<size_t>(cursor_row * width + cursor_col++);
+        text[cell] = c;
+        styles[cell] = attrs;
+    }
+}
+
+void VirtualTerminal::clear_line(){
+    size_t begin = static_cast<size_t>(cursor_row * width + std::min(cursor_col, width));
+    size_t end = static_cast<size_t>((cursor_row + 1) * width);
+    std::fill(text.begin() + begin, text.begin() + end, ' ');
+    std::fill(styles.begin() + begin, styles.begin() + end, 0);
+}
+
+void VirtualTerminal::attribute_on(int on){
+    attrs |= on;
+}
+
+void VirtualTerminal::attribute_off(int off){
+    attrs &= ~off;
+}
+
+void VirtualTerminal::scroll_rows(int top, int bottom, int count){
+    for (int step = 0; step < std::abs(count); ++step) {
+        int from = count > 0 ? top : bottom;
+        int to = count > 0 ? bottom : top;
+        int direction = count > 0 ? 1 : -1;
+        for (int r = from; r != to; r += direction) {
+            std::copy_n(text.begin() + (r + direction) * width, width, text.begin() + r * width);
+            std::copy_n(styles.begin() + (r + direction) * width, width, styles.begin() + r * width);
+        }
+        std::fill_n(text.begin() + to * width, width, ' ');
+        std::fill_n(styles.begin() + to * width, width, 0);
+    }
+}
+
+void VirtualTerminal::flush(){
+    ++flushes;
+}
+
+void VirtualTerminal::set_escape_timeout(int){}
+
+void VirtualTerminal::feed(int key){
+    keys.push_back(key);
+}
+
+std::string VirtualTerminal::row(int r) const {
+    return std::string(text.begin() + r * width, text.begin() + (r + 1) * width);
+}
+
+size_t VirtualTerminal::emitted() const {
+    return bytes;
+}
+
+size_t VirtualTerminal::frames() const {
+    return flushes;
+}
@@ -0,0 +1,88 @@
+#ifndef TERMINAL_HPP
+#define TERMINAL_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <ncurses.h>
+
+static const int KEY_PASTE_BEGIN = KEY_MAX + 1;
+static const int KEY_PASTE_END = KEY_MAX + 2;
+
+// Everything the editor draws or reads goes through this interface. Key codes
+// and attributes use the ncurses values (KEY_*, A_*, COLOR_PAIR) in every
+// backend; read_key returns ERR when no key arrives within the timeout, and
+// a negative timeout waits forever. The escape timeout is how long a lone
+// escape waits for the rest of a key sequence before it counts as Esc.
+class Terminal {
+public:
+    virtual ~Terminal() = default;
+    virtual int rows() const = 0;
+    virtual int cols() const = 0;
+    virtual int read_key(int timeout_ms) = 0;
+    virtual void place(int row, int col) = 0;
+    virtual void put(std::string_view text) = 0;
+    virtual void clear_line() = 0;
+    virtual void attribute_on(int attrs) = 0;
+    virtual void attribute_off(int attrs) = 0;
+    virtual void scroll_rows(int top, int bottom, int count) = 0;
+    virtual void flush() = 0;
+    virtual void set_escape_timeout(int timeout_ms) = 0;
+};
+
+class NcursesTerminal : public Terminal {
+public:
+    NcursesTerminal();
+    ~NcursesTerminal();
+
+    int rows() const override;
+    int cols() const override;
+    int read_key(int timeout_ms) override;
+    void place(int row, int col) override;
+    void put(std::string_view text) override;
+    void clear_line() override;
+    void attribute_on(int attrs) override;
+    void attribute_off(int attrs) override;
+    void scroll_rows(int top, int bottom, int count) override;
+    void flush() override;
+    void set_escape_timeout(int timeout_ms) override;
+};
+
+// A screen held in memory for benchmarks and tests: keys are queued with
+// feed() and read_key never blocks.
+class VirtualTerminal : public Terminal {
+public:
+    VirtualTerminal(int rows, int cols);
+
+    int rows() const override;
+    int cols() const override;
+    int read_key(int timeout_ms) override;
+    void place(int row, int col) override;
+    void put(std::string_view text) override;
+    void clear_line() override;
+    void attribute_on(int attrs) override;
+    void attribute_off(int attrs) override;
+    void scroll_rows(int top, int bottom, int count) override;
+    void flush() override;
+    void set_escape_timeout(int timeout_ms) override;
+
+    void feed(int key);
+    std::string row(int r) const;
+    size_t emitted() const;
+    size_t frames() const;
+
+private:
+    int height;
+    int width;
+    int cursor_row;
+    int cursor_col;
+    int attrs;
+    std::vector<char> text;
+    std::vector<int> styles;
+    std::deque<int> keys;
+    size_t bytes;
+    size_t flushes;
+};
+
+#endif
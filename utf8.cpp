@@ -0,0 +1,132 @@
+#include "utf8.hpp"
+#include <algorithm>
+#include <cwchar>
+
+struct Range {
+    uint32_t first;
+    uint32_t last;
+};
+
+static const Range ZERO_WIDTH[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0x1F3FB, 0x1F3FF},
+    {0xE0020, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+static const Range DOUBLE_WIDTH[] = {
+    {0x1100, 0x115F}, {0x2E80, 0x303E}, {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF},
+    {0xA000, 0xA4CF}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE30, 0xFE4F}, {0xFF00, 0xFF60},
+    {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F}, {0x1F900, 0x1F9FF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+static const uint32_t ZERO_WIDTH_JOINER = 0x200D;
+
+template <size_t N>
+static bool within(const Range (&ranges)[N], uint32_t code){
+    for (const Range& range : ranges) {
+        if (code < range.first) return false;
+        if (code <= range.last) return true;
+    }
+    return false;
+}
+
+size_t utf8_sequence(unsigned char lead){
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 1;
+}
+
+// Decodes the code point starting at byte at and returns its length. A
+// malformed sequence counts as one byte of U+FFFD so the text still advances.
+size_t utf8_decode(std::string_view text, size_t at, uint32_t& code){
+    unsigned char lead = static_cast<unsigned char>(text[at]);
+    size_t length = utf8_sequence(lead);
+    if (length == 1 || at + length > text.length()) {
+        code = lead < 0x80 ? lead : 0xFFFD;
+        return 1;
+    }
+    code = lead & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        unsigned char next = static_cast<unsigned char>(text[at + i]);
+        if ((next & 0xC0) != 0x80) {
+            code = 0xFFFD;
+            return 1;
+        }
+        code = (code << 6) | (next & 0x3F);
+    }
+    return length;
+}
+
+// Widths come from the C library, which ncurses asks too, so the cursor
+// lands on the cells a character was drawn in. Outside a UTF-8 locale, as
+// in the benchmarks, wcwidth knows nothing past ASCII and the tables above
+// stand in.
+int char_width(uint32_t code){
+    if (code < 0x0300) return 1;
+    int width = wcwidth(static_cast<wchar_t>(code));
+    if (width >= 0) return width;
+    if (code == ZERO_WIDTH_JOINER || within(ZERO_WIDTH, code)) return 0;
+    return within(DOUBLE_WIDTH, code) ? 2 : 1;
+}
+
+// Whether a code point joins the character before it. Emoji modifiers are
+// drawn wide but still belong to the emoji they follow.
+static bool extends(uint32_t code){
+    return code >= 0x0300 && (code == ZERO_WIDTH_JOINER || within(ZERO_WIDTH, code) || wcwidth(static_cast<wchar_t>(code)) == 0);
+}
+
+// Grapheme boundaries: a base character followed by any combining marks,
+// variation selectors and emoji modifiers, with ZWJ gluing the next one on.
+size_t next_grapheme(std::string_view line, size_t at){
+    if (at >= line.length()) return line.length();
+    uint32_t code;
+    at += utf8_decode(line, at, code);
+    while (at < line.length()) {
+        uint32_t next;
+        size_t length = utf8_decode(line, at, next);
+        if (!extends(next) && code != ZERO_WIDTH_JOINER) break;
+        code = next;
+        at += length;
+    }
+    return at;
+}
+
+static size_t prev_code(std::string_view line, size_t at, uint32_t& code){
+    size_t start = at - 1;
+    while (start > 0 && at - start < 4 && (static_cast<unsigned char>(line[start]) & 0xC0) == 0x80) {
+        --start;
+    }
+    if (start + utf8_decode(line, start, code) != at) {
+        start = at - 1;
+        code = 0xFFFD;
+    }
+    return start;
+}
+
+size_t prev_grapheme(std::string_view line, size_t at){
+    at = std::min(at, line.length());
+    if (at == 0) return 0;
+    uint32_t code;
+    at = prev_code(line, at, code);
+    while (at > 0) {
+        uint32_t before;
+        size_t start = prev_code(line, at, before);
+        if (!extends(code) && before != ZERO_WIDTH_JOINER) break;
+        code = before;
+        at = start;
+    }
+    return at;
+}
+
+size_t display_width(std::string_view text){
+    size_t width = 0;
+    for (size_t at = 0; at < text.length();) {
+        uint32_t code;
+        at += utf8_decode(text, at, code);
+        width += static_cast<size_t>(char_width(code));
+    }
+    return width;
+}
@@ -0,0 +1,14 @@
+#ifndef UTF8_HPP
+#define UTF8_HPP
+
+#include <string_view>
+#include <cstdint>
+
+size_t utf8_sequence(unsigned char lead);
+size_t utf8_decode(std::string_view text, size_t at, uint32_t& code);
+int char_width(uint32_t code);
+size_t next_grapheme(std::string_view line, size_t at);
+size_t prev_grapheme(std::string_view line, size_t at);
+size_t display_width(std::string_view text);
+
+#endif